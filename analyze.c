@@ -0,0 +1,206 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libtetris.h"
+#include "replay.h"
+#include "pool.h"
+
+/***********************************************************************
+ *
+ * TETRIS-ANALYZE - Re-simulate recorded games in parallel
+ *
+ *     Each replay file (see replay.h) is memory mapped and run through
+ *     the engine straight from the mapping, one file per task on a
+ *     work stealing pool (pool.c). Prints a line per game, then totals:
+ *
+ *         tetris-analyze [--threads n] [--quiet] dir-or-file..
+ *
+ ***********************************************************************/
+
+/* ONE GAME'S TASK AND RESULTS */
+typedef struct {
+    char *path;
+    int   ok;                   /* 0: couldn't read it */
+    long  size, steps, inputs, ms;
+    int   rows, pieces, dead;
+    unsigned long hits[TETRIS_HITS];
+} Analysis;
+
+Analysis *Ggames  = NULL;
+long      Gngames = 0, Gmaxgames = 0;
+
+/* COUNT THE PLAYER'S KEYS IN A STEP (gravity isn't one) */
+long Inputs(const TetrisInput *in)
+{
+    return(labs(in->x) + labs(in->y) + labs(in->rotate));
+}
+
+/* RE-SIMULATE ONE REPLAY FILE (pool task) */
+void Analyze(void *arg, int worker)
+{
+    Analysis *a = (Analysis*)arg;
+    ReplayReader r;
+    TetrisGame g;
+    TetrisInput in;
+    struct stat st;
+    unsigned char *data;
+    int fd;
+    (void)worker;
+
+    if ((fd = open(a->path, O_RDONLY)) < 0) { perror(a->path); return; }
+    if (fstat(fd, &st) < 0) { perror(a->path); close(fd); return; }
+    if (st.st_size == 0) { fprintf(stderr, "%s: empty\n", a->path); close(fd); return; }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) { perror(a->path); return; }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    if (ReplayOpen(&r, data, (long)st.st_size) < 0) {
+        fprintf(stderr, "%s: not a replay file\n", a->path);
+    } else {
+        ReplayStart(&r, &g);
+        while (ReplayNext(&r, &in, &a->ms)) {
+            a->inputs += Inputs(&in);
+            TetrisStep(&g, &in);
+            a->steps++;
+        }
+        a->ok     = 1;
+        a->size   = (long)st.st_size;
+        a->rows   = g.rows;
+        a->pieces = g.pieces;
+        a->dead   = g.dead;
+        memcpy(a->hits, g.hits, sizeof(a->hits));
+        ReplayFree(&r);
+    }
+    munmap(data, st.st_size);
+}
+
+/* ADD A FILE TO ANALYZE */
+void AddGame(const char *path)
+{
+    if (Gngames == Gmaxgames) {
+        Gmaxgames = Gmaxgames ? Gmaxgames * 2 : 1024;
+        if (!(Ggames = realloc(Ggames, Gmaxgames * sizeof(Analysis)))) {
+            perror("tetris-analyze: realloc");
+            exit(1);
+        }
+    }
+    memset(&Ggames[Gngames], 0, sizeof(Analysis));
+    if (!(Ggames[Gngames].path = strdup(path))) {
+        perror("tetris-analyze: strdup");
+        exit(1);
+    }
+    Gngames++;
+}
+
+/* ADD A FILE, OR EVERY FILE IN A DIRECTORY */
+void AddPath(const char *path)
+{
+    struct stat st;
+    struct dirent *e;
+    DIR *dir;
+    char *file;
+
+    if (stat(path, &st) < 0) { perror(path); return; }
+    if (!S_ISDIR(st.st_mode)) { AddGame(path); return; }
+    if (!(dir = opendir(path))) { perror(path); return; }
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] == '.') continue;
+        if (!(file = malloc(strlen(path) + strlen(e->d_name) + 2))) {
+            perror("tetris-analyze: malloc");
+            exit(1);
+        }
+        sprintf(file, "%s/%s", path, e->d_name);
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode)) AddGame(file);
+        free(file);
+    }
+    closedir(dir);
+}
+
+/* SORT GAMES BY PATH (qsort) */
+int ComparePaths(const void *a, const void *b)
+{
+    return(strcmp(((const Analysis*)a)->path, ((const Analysis*)b)->path));
+}
+
+/* WALL CLOCK SECONDS */
+double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+void Usage(void)
+{
+    fprintf(stderr, "usage: tetris-analyze [--threads n] [--quiet] dir-or-file..\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *hitnames[TETRIS_HITS] = { "moved", "edge", "blocked", "locked" };
+    Analysis *a;
+    Pool *pool;
+    int t, h, nthreads = 0, quiet = 0, ok = 0, died = 0;
+    double start, secs, rows = 0, pieces = 0, inputs = 0, ms = 0, deathms = 0,
+           bytes = 0, steps = 0, hits[TETRIS_HITS] = { 0 }, allhits = 0;
+
+    for (t=1; t<argc; t++) {
+        if      (strcmp(argv[t], "--threads") == 0 && t+1 < argc) nthreads = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--quiet")   == 0) quiet = 1;
+        else if (argv[t][0] == '-') Usage();
+        else AddPath(argv[t]);
+    }
+    if (Gngames == 0) Usage();
+    qsort(Ggames, Gngames, sizeof(Analysis), ComparePaths);
+
+    pool  = PoolCreate(nthreads);
+    start = Now();
+    for (t=0; t<Gngames; t++)
+        PoolSubmit(pool, -1, Analyze, &Ggames[t]);
+    PoolWait(pool);
+    secs = Now() - start;
+    nthreads = PoolThreads(pool);
+    PoolDestroy(pool);
+
+    if (!quiet)
+        printf("%-30s %6s %6s %7s %8s %9s %s\n",
+               "game", "rows", "pieces", "steps", "keys/sec", "secs", "end");
+    for (t=0; t<Gngames; t++) {
+        a = &Ggames[t];
+        if (!a->ok) continue;
+        ok++;
+        rows += a->rows; pieces += a->pieces; inputs += a->inputs;
+        steps += a->steps; ms += a->ms; bytes += a->size;
+        if (a->dead) { died++; deathms += a->ms; }
+        for (h=0; h<TETRIS_HITS; h++) { hits[h] += a->hits[h]; allhits += a->hits[h]; }
+        if (!quiet)
+            printf("%-30s %6d %6d %7ld %8.2f %9.1f %s\n",
+                   a->path, a->rows, a->pieces, a->steps,
+                   a->ms ? a->inputs * 1000.0 / a->ms : 0.0, a->ms / 1000.0,
+                   a->dead ? "died" : "quit");
+    }
+    if (!ok) return(1);
+
+    printf("\ngames %d of %ld read, threads %d, %.2f secs, %.1f games/sec, %.1f MB/sec\n",
+           ok, Gngames, nthreads, secs, secs > 0 ? ok / secs : 0.0,
+           secs > 0 ? bytes / secs / 1e6 : 0.0);
+    printf("per game: rows %.1f, pieces %.1f, steps %.1f, keys/sec %.2f\n",
+           rows / ok, pieces / ok, steps / ok, ms > 0 ? inputs * 1000.0 / ms : 0.0);
+    if (died) printf("died: %d games, mean time to death %.1f secs\n", died, deathms / died / 1000.0);
+    else      printf("died: none\n");
+    printf("collisions:");
+    for (h=0; h<TETRIS_HITS; h++)
+        printf(" %s %.0f (%.1f%%)", hitnames[h], hits[h], allhits ? hits[h] * 100 / allhits : 0.0);
+    printf("\n");
+    return(0);
+}
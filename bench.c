@@ -0,0 +1,447 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "libtetris.h"
+#include "screen.h"
+#include "eval.h"
+
+/***********************************************************************
+ *
+ * TETRIS-BENCH - Time the engine's and the screen's hot paths
+ *
+ *     Every benchmark runs over a fixed corpus of boards, made by
+ *     placing shapes at random from a seed, so the numbers only change
+ *     when the code does. Each is run for at least --msec, doubling
+ *     the iterations 'til it has, and is printed as one line in the
+ *     Go benchmark format (name, iterations, ns/op, other metrics),
+ *     which benchstat and friends can compare between builds:
+ *
+ *         tetris-bench [--seed n] [--boards n] [--msec n] [--count n]
+ *                      [--term type] [name..]
+ *
+ *     Collision       TetrisCollision() at random positions on the boards
+ *     Compose/shape   FrameCompose() of the rows a moving shape covers (DrawShape)
+ *     Compose/all     FrameCompose() of the whole playfield
+ *     Place/rows=N    TetrisPlace() petrifying a shape that completes N rows
+ *                     (PetrifyScreen + HandleCompletedRows), on a fresh copy
+ *                     of the game each time (the copy's included)
+ *     Redraw/changed  ScreenDraw() of a recorded game's Redraw(CHANGED)
+ *                     frames (and an ALL one to start each cycle) into a
+ *                     null writer, for --term's backend (default vt100);
+ *                     also reports bytes/op
+ *     Redraw/all      ScreenDraw() of a full Redraw(ALL) frame
+ *     Redraw/vterm    Redraw/changed on a virtual terminal (VTerm): the
+ *                     output decoded into a screen grid too
+ *     Eval/K          EvalRun() of a batch of EVALBATCH boards with
+ *                     kernel K (scalar, sse2, avx2; ones this CPU
+ *                     can't run are left out); also reports ns/board
+ *
+ *     Before timing anything, the recorded frames are drawn on a VTerm
+ *     and what it shows is checked against them, and every eval kernel
+ *     is checked against the scalar one, so a broken screen or kernel
+ *     can't produce good numbers.
+ *
+ *     Names given on the command line pick benchmarks by prefix.
+ *
+ ***********************************************************************/
+
+#define QUERIES     4096        /* collision positions tried (cycled) */
+#define FRAMES      4096        /* frames recorded for Redraw/changed */
+
+typedef void BenchFunc(long iters);
+
+/* THE CORPUS */
+TetrisGame *Gboards;            /* boards with a shape about to be placed */
+int   Gnboards = 256;           /* --boards */
+unsigned long long Grng;        /* corpus random numbers (--seed) */
+struct { int board, x, y, rotate; } Gqueries[QUERIES];
+TetrisGame Gplace[SHAPEMAX+1];  /* games whose shape will complete 0..4 rows */
+TetrisPlacement Gplaceat[SHAPEMAX+1];
+Frame Gframes[FRAMES];          /* a game's Redraw() frames, first one ALL */
+Screen Gscreen;                 /* draws to the null writer */
+Screen Gvscreen;                /* draws on Gvterm */
+VTerm Gvterm;
+char  Gout[8192], Gvout[8192];
+char *Gterm = NULL;             /* --term */
+long  Gbytes = 0;               /* bytes the null writer was given */
+EvalBatch Gbatch;               /* the first EVALBATCH boards, for Eval/K */
+volatile long Gsink;            /* (results go here, so nothing's optimized out) */
+
+/* CORPUS RANDOM NUMBER 0..n-1 (splitmix64) */
+int Rand(int n)
+{
+    unsigned long long z = (Grng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return((int)((z ^ (z >> 31)) % (unsigned long long)n));
+}
+
+/* COUNT OUTPUT, THEN DROP IT (ScreenWriter) */
+int NullWrite(void *arg, const char *buf, int len)
+{
+    (void)arg; (void)buf;
+    Gbytes += len;
+    return(1);
+}
+
+/* PLACE THE CURRENT SHAPE SOMEWHERE AT RANDOM
+ *     Returns 0 if it can't go anywhere.
+ */
+int RandomPlace(TetrisGame *g)
+{
+    TetrisPlacement list[TETRIS_MAXPLACEMENTS];
+    int n = TetrisPlacements(g, list);
+    if (n == 0) return(0);
+    TetrisPlace(g, &list[Rand(n)]);
+    return(!g->dead);
+}
+
+/* BUILD THE CORPUS
+ *     Boards get 0..39 random placements; ones that die start over.
+ */
+void MakeCorpus(unsigned long long seed)
+{
+    TetrisPlacement list[TETRIS_MAXPLACEMENTS];
+    TetrisGame g;
+    TetrisInput in;
+    int b, t, n, r;
+
+    Grng = seed;
+    if (!(Gboards = malloc(Gnboards * sizeof(TetrisGame)))) {
+        perror("tetris-bench: malloc");
+        exit(1);
+    }
+    for (b=0; b<Gnboards; b++) {
+        do {
+            TetrisInit(&g, seed + b);
+            for (t=Rand(40); t>0; t--)
+                if (!RandomPlace(&g)) break;
+        } while (g.dead || TetrisPlacements(&g, list) == 0);
+        Gboards[b] = g;
+    }
+
+    for (t=0; t<QUERIES; t++) {         /* anywhere a shape's box could overlap the field */
+        Gqueries[t].board  = Rand(Gnboards);
+        Gqueries[t].x      = Rand(GAMEWIDTH + SHAPEMAX) - SHAPEMAX + 1;
+        Gqueries[t].y      = Rand(GAMEHEIGHT + SHAPEMAX) - SHAPEMAX + 1;
+        Gqueries[t].rotate = Rand(4);
+    }
+
+    /* COMPLETING 0..4 ROWS
+     *     The bottom four rows are full but for column 0 (and for rows
+     *     above the 'r' lowest, column 9 too); an upright I dropped in
+     *     column 0 completes 'r' rows.
+     */
+    for (r=0; r<=SHAPEMAX; r++) {
+        TetrisInit(&g, seed);
+        for (t=0; t<SHAPEMAX; t++) {
+            g.board[GAMEHEIGHT-1-t] = FULLROW & ~((Row)1 << FIELDSHIFT);
+            if (t >= r) g.board[GAMEHEIGHT-1-t] &= ~((Row)1 << (FIELDSHIFT+GAMEWIDTH-1));
+        }
+        TetrisIndexBoard(&g);
+        g.shape  = 2;                   /* I (see SHAPENAMES in perft.c) */
+        g.rotate = 0;
+        g.x      = TetrisSpawn[g.shape][0];
+        g.y      = TetrisSpawn[g.shape][1];
+        n = TetrisPlacements(&g, list);
+        for (t=0; t<n; t++) {
+            TetrisGame try = g;
+            TetrisPlace(&try, &list[t]);
+            if (try.ncleared == r && !try.dead) break;
+        }
+        if (t == n) {
+            fprintf(stderr, "tetris-bench: no placement completes %d rows\n", r);
+            exit(1);
+        }
+        Gplace[r]   = g;
+        Gplaceat[r] = list[t];
+    }
+
+    /* RECORD A GAME'S FRAMES
+     *     Random keys, with gravity every 8th; a game that ends is
+     *     followed by a new one (and an ALL frame).
+     */
+    ScreenInit(&Gscreen, Gterm, Gout, sizeof(Gout), NullWrite, NULL);
+    TetrisInit(&g, seed);
+    FrameCompose(&Gframes[0], &g, ALL);
+    for (t=1; t<FRAMES; t++) {
+        memset(&in, 0, sizeof(in));
+        switch (Rand(8)) {
+            case 0: case 1: in.x = -1;     break;
+            case 2: case 3: in.x = 1;      break;
+            case 4: case 5: in.rotate = 1; break;
+            case 6:         in.y = 1;      break;
+            case 7:         in.yforce = 1; break;
+        }
+        if (TetrisStep(&g, &in) & TETRIS_DIED) {
+            TetrisInit(&g, seed + t);
+            FrameCompose(&Gframes[t], &g, ALL);
+            continue;
+        }
+        FrameCompose(&Gframes[t], &g, CHANGED);
+    }
+}
+
+/* CHECK THE FRAMES DRAW WHAT THEY SAY
+ *     Each frame's rows are tracked, and compared with what a virtual
+ *     terminal shows after it's drawn. Then the last one is drawn again
+ *     as a test screen: the grid of 0s and 1s left of the playfield
+ *     must match it, and mustn't have drawn over it.
+ */
+void CheckFrames(void)
+{
+    Row want[GAMEHEIGHT], shown[GAMEHEIGHT];
+    Frame test;
+    int t, x, y;
+
+    ScreenInitVirtual(&Gvscreen, &Gvterm, Gvout, sizeof(Gvout));
+    for (t=0; t<FRAMES; t++) {
+        for (y=0; y<GAMEHEIGHT; y++)
+            if (Gframes[t].dirty & (1UL<<y)) want[y] = Gframes[t].rows[y];
+        ScreenDraw(&Gvscreen, &Gframes[t]);
+        VTermRows(&Gvterm, shown);
+        if (memcmp(want, shown, sizeof(want)) != 0) {
+            fprintf(stderr, "tetris-bench: frame %d drew the wrong screen\n", t);
+            exit(1);
+        }
+    }
+
+    test = Gframes[FRAMES-1];
+    test.dirty = 0;
+    test.test  = 1;
+    ScreenDraw(&Gvscreen, &test);
+    VTermRows(&Gvterm, shown);
+    for (y=0; y<GAMEHEIGHT; y++)                /* (grid starts at line 2, column 1) */
+        for (x=0; x<GAMEWIDTH; x++)
+            if (Gvterm.text[y+1][x] != ((want[y] >> (x+FIELDSHIFT)) & 1 ? '1' : '0'))
+                shown[y] = ~want[y];
+    if (memcmp(want, shown, sizeof(want)) != 0) {
+        fprintf(stderr, "tetris-bench: the test screen drew the wrong screen\n");
+        exit(1);
+    }
+}
+
+/* CHECK THE EVAL KERNELS AGREE
+ *     Each one's features for every corpus board, a batch at a time,
+ *     must be the scalar kernel's. Leaves Gbatch holding the first
+ *     boards, and the best kernel picked.
+ */
+void CheckEval(void)
+{
+    static const char *kernels[] = { "sse2", "avx2" };
+    static EvalBatch want;
+    int start, b, k, i;
+
+    for (start=Gnboards - (Gnboards-1) % EVALBATCH - 1; start>=0; start-=EVALBATCH) {
+        Gbatch.n = 0;
+        for (b=start; b<Gnboards && Gbatch.n<EVALBATCH; b++)
+            EvalAdd(&Gbatch, &Gboards[b], 0);
+        EvalUse("scalar");
+        want = Gbatch;
+        EvalRun(&want);
+        for (k=0; k<(int)(sizeof(kernels)/sizeof(kernels[0])); k++) {
+            if (!EvalUse(kernels[k])) continue;
+            EvalRun(&Gbatch);
+            for (i=0; i<Gbatch.n; i++)
+                if (Gbatch.height[i] != want.height[i] || Gbatch.holes[i] != want.holes[i] ||
+                    Gbatch.bumps[i]  != want.bumps[i]  || Gbatch.full[i]  != want.full[i]  ||
+                    Gbatch.transitions[i] != want.transitions[i]) {
+                    fprintf(stderr, "tetris-bench: eval kernel %s is wrong for board %d\n",
+                            kernels[k], start + i);
+                    exit(1);
+                }
+        }
+    }
+    EvalUse(NULL);
+}
+
+/* THE BENCHMARKS */
+void BenchCollision(long iters)
+{
+    long i, hits = 0;
+    int q;
+    for (i=0; i<iters; i++) {
+        q = (int)(i % QUERIES);
+        hits += TetrisCollision(&Gboards[Gqueries[q].board], Gqueries[q].x,
+                                Gqueries[q].y, Gqueries[q].rotate);
+    }
+    Gsink = hits;
+}
+
+void BenchComposeShape(long iters)
+{
+    TetrisGame *g;
+    Frame f;
+    long i, sum = 0;
+    for (i=0; i<iters; i++) {
+        g = &Gboards[i % Gnboards];
+        g->dirty = (g->y < 0) ? (0xfUL >> -g->y) : (0xfUL << g->y) & ALLROWS;
+        FrameCompose(&f, g, CHANGED);
+        sum += f.rows[GAMEHEIGHT-1];
+    }
+    Gsink = sum;
+}
+
+void BenchComposeAll(long iters)
+{
+    Frame f;
+    long i, sum = 0;
+    for (i=0; i<iters; i++) {
+        FrameCompose(&f, &Gboards[i % Gnboards], ALL);
+        sum += f.rows[GAMEHEIGHT-1];
+    }
+    Gsink = sum;
+}
+
+/* Place/rows=N */
+int Gplacerows;
+void BenchPlace(long iters)
+{
+    TetrisGame g;
+    long i, sum = 0;
+    for (i=0; i<iters; i++) {
+        g = Gplace[Gplacerows];
+        sum += TetrisPlace(&g, &Gplaceat[Gplacerows]);
+    }
+    Gsink = sum;
+}
+
+void BenchRedrawChanged(long iters)
+{
+    long i;
+    for (i=0; i<iters; i++)
+        ScreenDraw(&Gscreen, &Gframes[i % FRAMES]);
+}
+
+void BenchRedrawVTerm(long iters)
+{
+    long i, start = Gvterm.bytes;
+    for (i=0; i<iters; i++)
+        ScreenDraw(&Gvscreen, &Gframes[i % FRAMES]);
+    Gbytes = Gvterm.bytes - start;      /* (not the null writer's) */
+}
+
+void BenchRedrawAll(long iters)
+{
+    long i;
+    for (i=0; i<iters; i++)
+        ScreenDraw(&Gscreen, &Gframes[0]);
+}
+
+void BenchEval(long iters)
+{
+    long i, sum = 0;
+    for (i=0; i<iters; i++) {
+        EvalRun(&Gbatch);
+        sum += Gbatch.holes[i % Gbatch.n];
+    }
+    Gsink = sum;
+}
+
+/* WALL CLOCK NANOSECONDS */
+double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+/* RUN A BENCHMARK FOR AT LEAST 'msec'
+ *     Returns ns per iteration, and the iterations in 'iters'
+ *     (Gbytes is what the last run of them wrote).
+ */
+double Run(BenchFunc *func, long msec, long *iters)
+{
+    double start, ns;
+    long n = 1;
+    while (1) {
+        Gbytes = 0;
+        start  = Now();
+        func(n);
+        ns = Now() - start;
+        if (ns >= msec * 1e6 || n >= (1L << 40)) break;
+        n *= 2;
+    }
+    *iters = n;
+    return(ns / n);
+}
+
+/* DOES 'name' MATCH THE COMMAND LINE'S PICKS? */
+int Picked(const char *name, char **picks, int npicks)
+{
+    int t;
+    if (npicks == 0) return(1);
+    for (t=0; t<npicks; t++)
+        if (strncmp(name, picks[t], strlen(picks[t])) == 0) return(1);
+    return(0);
+}
+
+void Usage(void)
+{
+    fprintf(stderr, "usage: tetris-bench [--seed n] [--boards n] [--msec n] [--count n]\n"
+                    "                    [--term type] [name..]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static struct { const char *name; BenchFunc *func; int rows; } benches[] = {
+        { "Collision",      BenchCollision,     -1 },
+        { "Compose/shape",  BenchComposeShape,  -1 },
+        { "Compose/all",    BenchComposeAll,    -1 },
+        { "Place/rows=0",   BenchPlace,          0 },
+        { "Place/rows=1",   BenchPlace,          1 },
+        { "Place/rows=2",   BenchPlace,          2 },
+        { "Place/rows=3",   BenchPlace,          3 },
+        { "Place/rows=4",   BenchPlace,          4 },
+        { "Redraw/changed", BenchRedrawChanged, -1 },
+        { "Redraw/all",     BenchRedrawAll,     -1 },
+        { "Redraw/vterm",   BenchRedrawVTerm,   -1 },
+        { "Eval/scalar",    BenchEval,          -1 },
+        { "Eval/sse2",      BenchEval,          -1 },
+        { "Eval/avx2",      BenchEval,          -1 },
+    };
+    unsigned long long seed = 1;
+    char *picks[64];
+    int t, c, npicks = 0, count = 1;
+    long msec = 500, iters;
+    double ns;
+
+    for (t=1; t<argc; t++) {
+        if      (strcmp(argv[t], "--seed")   == 0 && t+1 < argc) seed     = strtoull(argv[++t], NULL, 10);
+        else if (strcmp(argv[t], "--boards") == 0 && t+1 < argc) Gnboards = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--msec")   == 0 && t+1 < argc) msec     = atol(argv[++t]);
+        else if (strcmp(argv[t], "--count")  == 0 && t+1 < argc) count    = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--term")   == 0 && t+1 < argc) Gterm    = argv[++t];
+        else if (argv[t][0] == '-' || npicks == 64) Usage();
+        else picks[npicks++] = argv[t];
+    }
+    if (Gnboards < 1 || msec < 1 || count < 1) Usage();
+
+    MakeCorpus(seed);
+    CheckFrames();
+    CheckEval();
+    printf("pkg: tetris\nseed: %llu\nboards: %d\nterm: %s\n", seed, Gnboards,
+           Gterm ? Gterm : "vt100");
+    for (c=0; c<count; c++) {
+        for (t=0; t<(int)(sizeof(benches)/sizeof(benches[0])); t++) {
+            if (!Picked(benches[t].name, picks, npicks)) continue;
+            if (benches[t].func == BenchEval && !EvalUse(benches[t].name + 5)) continue;
+            Gplacerows = benches[t].rows;
+            ns = Run(benches[t].func, msec, &iters);
+            printf("Benchmark%s\t%ld\t%.2f ns/op", benches[t].name, iters, ns);
+            if (benches[t].func == BenchCollision)
+                printf("\t%.0f calls/s", 1e9 / ns);
+            if (Gbytes)
+                printf("\t%.1f bytes/op", (double)Gbytes / iters);
+            if (benches[t].func == BenchEval)
+                printf("\t%.2f ns/board", ns / Gbatch.n);
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+    return(0);
+}
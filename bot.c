@@ -0,0 +1,274 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "bot.h"
+
+#ifndef _WIN32
+    #include <pthread.h>
+    #include <unistd.h>                 /* sysconf() */
+#endif
+
+/***********************************************************************
+ *
+ * BOT - Picks placements for a TetrisGame
+ *
+ *     See bot.h. On Windows there's no thread pool; BotChoose() always
+ *     scores the placements itself.
+ *
+ ***********************************************************************/
+
+#define WORST   -1e30                   /* score of a board that ends the game */
+
+/* Weights from Yiyuan Lee's genetic tuning of the first four features
+ * (the tuned defaults don't use transitions)
+ */
+const BotWeights BotDefaultWeights = { -0.510066, 0.760666, -0.35663, -0.184483, 0.0 };
+
+/* RATE BOARD i OF A BATCH EvalRun() HAS BEEN ON */
+double BotRate(const EvalBatch *b, int i, const BotWeights *w)
+{
+    return(w->height * b->height[i] + w->lines * (b->lines[i] + b->full[i]) +
+           w->holes  * b->holes[i]  + w->bumpiness * b->bumps[i] +
+           w->transitions * b->transitions[i]);
+}
+
+/* THE BEST OF A BATCH'S BOARDS, OR 'best' */
+static double BestOf(EvalBatch *b, const BotWeights *w, double best)
+{
+    double score;
+    int i;
+    EvalRun(b);
+    for (i=0; i<b->n; i++)
+        if ((score = BotRate(b, i, w)) > best) best = score;
+    b->n = 0;
+    return(best);
+}
+
+/* RATE A BOARD
+ *     'lines' is how many rows were completed getting to it.
+ */
+double BotEvaluate(const TetrisGame *g, const BotWeights *w, int lines)
+{
+    EvalBatch b;
+    b.n = 0;
+    EvalAdd(&b, g, lines);
+    return(BestOf(&b, w, WORST));
+}
+
+/* SEARCH SETTINGS (BotSearch()) */
+static int    G_depth = 2;              /* shapes placed in each line of play */
+static Table *G_table = NULL;           /* positions already searched */
+
+/* TABLE KEY OF A SEARCH NODE
+ *     Its value depends on the board ('h'), the shape to place, how
+ *     deep it's searched, the rows completed since the root (scores
+ *     count them) and the weights.
+ */
+static unsigned long long Key(unsigned long long h, const TetrisGame *g, int depth,
+                              int lines, const BotWeights *w)
+{
+    unsigned long long k, bits;
+    const double *f = &w->height;
+    int t;
+    k = TableMix(((unsigned long long)lines << 16) | ((unsigned long long)depth << 8) |
+                 (unsigned long long)g->shape);
+    for (t=0; t<(int)(sizeof(BotWeights) / sizeof(double)); t++) {
+        memcpy(&bits, &f[t], sizeof(bits));
+        k = TableMix(k ^ bits);
+    }
+    return(h ^ k);
+}
+
+/* BEST SCORE FOR PLACING g's CURRENT SHAPE, 'depth' SHAPES DEEP
+ *     Shapes after g's aren't known yet, so each is scored as the
+ *     average over all seven. Boards 'depth' shapes down are rated a
+ *     batch at a time, counting the rows completed since 'root'; 'h'
+ *     is the TableHash() of g's board (with a table).
+ */
+static double Search(const TetrisGame *root, const TetrisGame *g, unsigned long long h,
+                     int depth, const BotWeights *w)
+{
+    TetrisPlacement list[TETRIS_MAXPLACEMENTS];
+    TetrisGame g1;
+    EvalBatch b;
+    unsigned long long key = 0, h1 = 0;
+    double score, best = WORST;
+    int n, t, s;
+
+    if (G_table) {
+        key = Key(h, g, depth, g->rows - root->rows, w);
+        if (TableProbe(G_table, key, depth, &best)) return(best);
+    }
+    n = TetrisPlacements(g, list);
+    b.n = 0;
+    for (t=0; t<n; t++) {
+        g1 = *g;
+        if (TetrisPlace(&g1, &list[t]) & TETRIS_DIED) continue;
+        if (depth == 1) {
+            EvalAdd(&b, &g1, g1.rows - root->rows);
+            if (b.n == EVALBATCH) best = BestOf(&b, w, best);
+            continue;
+        }
+        if (G_table) h1 = TableRehash(h, g->board, g1.board);
+        for (score=0, s=0; s<MAXSHAPES; s++) {  /* (not g1's own next: that'd be peeking) */
+            g1.shape  = s;
+            g1.x      = TetrisSpawn[s][0];
+            g1.y      = TetrisSpawn[s][1];
+            g1.rotate = 0;
+            score += Search(root, &g1, h1, depth-1, w);
+        }
+        if ((score /= MAXSHAPES) > best) best = score;
+    }
+    if (b.n) best = BestOf(&b, w, best);
+    if (G_table) TableStore(G_table, key, depth, best);
+    return(best);
+}
+
+/* SCORE ONE PLACEMENT OF THE CURRENT SHAPE
+ *     The best score over every placement of the next shape (and, with
+ *     BotSearch() deeper than 2, of the shapes after it).
+ */
+double BotScore(const TetrisGame *g, const BotWeights *w, const TetrisPlacement *p)
+{
+    TetrisGame g1;
+
+    g1 = *g;
+    if (TetrisPlace(&g1, p) & TETRIS_DIED) return(WORST);
+    if (G_depth < 2) return(BotEvaluate(&g1, w, g1.rows - g->rows));
+    return(Search(g, &g1, G_table ? TableHash(g1.board) : 0, G_depth - 1, w));
+}
+
+/* SET HOW FAR AHEAD TO SEARCH
+ *     'depth' shapes are placed in each line of play: 1 is just the
+ *     current shape, 2 (the default) the next one as well, and each
+ *     past that one more shape nobody knows yet (7 times the work).
+ *     With 'tablebytes' a transposition table of about that size keeps
+ *     positions already searched; 0 has none. Call before BotChoose(),
+ *     and not while it's running.
+ */
+void BotSearch(int depth, size_t tablebytes)
+{
+    G_depth = (depth < 1) ? 1 : (depth > 255) ? 255 : depth;
+    if (G_table) TableDestroy(G_table);
+    G_table = tablebytes ? TableCreate(tablebytes) : NULL;
+}
+
+/* THE TRANSPOSITION TABLE'S COUNTS
+ *     Returns 0 if there's no table.
+ */
+int BotTableStats(TableStats *s)
+{
+    if (!G_table) return(0);
+    TableCount(G_table, s);
+    return(1);
+}
+
+/* WORKER THREAD POOL (POSIX threads)
+ *     BotChoose() posts a job (the placements to score) and bumps
+ *     G_job; workers and the caller take placements off it one at a
+ *     time until they're all scored.
+ */
+typedef struct {
+    const TetrisGame      *g;
+    const BotWeights      *w;
+    const TetrisPlacement *list;
+    double                *scores;
+    int n,                      /* placements to score */
+        next,                   /* next one to take */
+        done;                   /* ones scored */
+} BotJob;
+
+#ifndef _WIN32
+static BotJob          G_botjob;
+static int             G_nthreads = 0;                          /* 0: no pool */
+static pthread_mutex_t G_botlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  G_botwork = PTHREAD_COND_INITIALIZER,    /* new job */
+                       G_botdone = PTHREAD_COND_INITIALIZER;    /* job finished */
+static unsigned long   G_job = 0;                               /* job count */
+
+/* SCORE PLACEMENTS FROM THE JOB UNTIL NONE ARE LEFT
+ *     Called with G_botlock held; scoring runs unlocked.
+ */
+static void WorkJob(void)
+{
+    BotJob *j = &G_botjob;
+    int t;
+    while (j->next < j->n) {
+        t = j->next++;
+        pthread_mutex_unlock(&G_botlock);
+        j->scores[t] = BotScore(j->g, j->w, &j->list[t]);
+        pthread_mutex_lock(&G_botlock);
+        if (++j->done == j->n) pthread_cond_signal(&G_botdone);
+    }
+}
+
+static void *Worker(void *arg)
+{
+    unsigned long seen = 0;
+    (void)arg;
+    pthread_mutex_lock(&G_botlock);
+    while (1) {
+        while (G_job == seen)
+            pthread_cond_wait(&G_botwork, &G_botlock);
+        seen = G_job;
+        WorkJob();
+    }
+    return(NULL);
+}
+
+/* START THE WORKER THREADS
+ *     nthreads = 0 starts one per CPU (less the caller, which works too).
+ *     Call once; without it, BotChoose() works alone.
+ */
+void BotStart(int nthreads)
+{
+    pthread_t tid;
+    int t;
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    for (t=0; t<nthreads; t++) {
+        if (pthread_create(&tid, NULL, Worker, NULL) != 0) break;
+        pthread_detach(tid);
+    }
+    G_nthreads = t;
+}
+#else
+void BotStart(int nthreads)
+{
+    (void)nthreads;                     /* no threads: BotChoose() works alone */
+}
+#endif
+
+/* PICK THE BEST PLACEMENT FOR THE CURRENT SHAPE
+ *     Returns 0 if every placement ends the game.
+ */
+int BotChoose(const TetrisGame *g, const BotWeights *w, TetrisPlacement *best)
+{
+    TetrisPlacement list[TETRIS_MAXPLACEMENTS];
+    double scores[TETRIS_MAXPLACEMENTS];
+    int n, t, b;
+
+    if ((n = TetrisPlacements(g, list)) == 0) return(0);
+    if (G_table) TableAge(G_table);
+
+#ifndef _WIN32
+    if (G_nthreads) {
+        pthread_mutex_lock(&G_botlock);
+        G_botjob.g = g; G_botjob.w = w; G_botjob.list = list; G_botjob.scores = scores;
+        G_botjob.n = n; G_botjob.next = G_botjob.done = 0;
+        G_job++;
+        pthread_cond_broadcast(&G_botwork);
+        WorkJob();                              /* lend a hand */
+        while (G_botjob.done < n)
+            pthread_cond_wait(&G_botdone, &G_botlock);
+        pthread_mutex_unlock(&G_botlock);
+    } else
+#endif
+    for (t=0; t<n; t++)
+        scores[t] = BotScore(g, w, &list[t]);
+
+    for (b=0, t=1; t<n; t++)
+        if (scores[t] > scores[b]) b = t;
+    *best = list[b];
+    return(1);
+}
@@ -0,0 +1,42 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#ifndef BOT_H
+#define BOT_H
+#include "libtetris.h"
+#include "eval.h"
+#include "table.h"
+
+/***********************************************************************
+ *
+ * BOT - Picks placements for a TetrisGame
+ *
+ *     Each placement of the current shape is scored by trying every
+ *     placement of the next shape on the board it leaves, and rating
+ *     the best resulting board on a few features (worked out for all of
+ *     them at once, see eval.h). BotSearch() can look further ahead,
+ *     over shapes not yet known, with a transposition table so boards
+ *     reached more than one way are searched once. With BotStart() the
+ *     placements are scored by a pool of worker threads.
+ *
+ ***********************************************************************/
+
+/* FEATURE WEIGHTS (score = sum of weight * feature) */
+typedef struct {
+    double height,              /* sum of the column heights */
+           lines,               /* rows completed by both shapes */
+           holes,               /* empty boxes with a box above them */
+           bumpiness,           /* sum of height steps between columns */
+           transitions;         /* filled/empty changes along the rows */
+} BotWeights;
+
+extern const BotWeights BotDefaultWeights;
+
+void   BotStart(int nthreads);
+void   BotSearch(int depth, size_t tablebytes);
+int    BotTableStats(TableStats *s);
+double BotRate(const EvalBatch *b, int i, const BotWeights *w);
+double BotEvaluate(const TetrisGame *g, const BotWeights *w, int lines);
+double BotScore(const TetrisGame *g, const BotWeights *w, const TetrisPlacement *p);
+int    BotChoose(const TetrisGame *g, const BotWeights *w, TetrisPlacement *best);
+
+#endif /*BOT_H*/
@@ -0,0 +1,247 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <string.h>
+#include "eval.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define EVAL_X86
+    #include <immintrin.h>
+#endif
+
+/***********************************************************************
+ *
+ * EVAL - Board features for a batch of boards at once (see eval.h)
+ *
+ *     Every feature is a sum over the rows, top down, of bits counted
+ *     in a word or two, given 'covered' (the columns with a box in this
+ *     row or any above):
+ *
+ *         height       bits in covered (a column of height h is
+ *                      covered in its bottom h rows)
+ *         holes        bits in covered (before this row) & ~row
+ *         bumps        bits where covered differs from the column to
+ *                      its right (|h[x] - h[x+1]| rows differ)
+ *         transitions  bits where the row, with its walls filled,
+ *                      differs from the box to its right
+ *         full         rows that are FULLROW
+ *
+ *     So there's no [y][x] loop anywhere, and no branches for a vector
+ *     kernel to trip on; the SSE2 and AVX2 ones are the scalar one with
+ *     a lane per board. Their bit counts are the usual SWAR shifts and
+ *     masks, as counting bits in vector lanes needs AVX-512.
+ *
+ ***********************************************************************/
+
+#define PAIRS   (FULLROW & (FULLROW >> 1))      /* columns with one to their right */
+#define WALLS   (((Row)1 << (FIELDSHIFT-1)) | ((Row)1 << (FIELDSHIFT+GAMEWIDTH)))
+#define EDGES   (FULLROW | (FULLROW >> 1))      /* left wall and the columns */
+
+/* FEATURES OF BOARDS from..to-1 */
+typedef void EvalFunc(EvalBatch *b, int from, int to);
+
+/* COUNT BITS SET IN A ROW */
+static int BitCount(Row bits)
+{
+    int n;
+    for (n=0; bits; n++) bits &= bits - 1;
+    return(n);
+}
+
+/* SCALAR KERNEL */
+static void Scalar(EvalBatch *b, int from, int to)
+{
+    Row r, covered, walled;
+    int i, y, height, holes, bumps, trans, full;
+
+    for (i=from; i<to; i++) {
+        covered = 0;
+        height = holes = bumps = trans = full = 0;
+        for (y=0; y<GAMEHEIGHT; y++) {
+            r        = b->rows[y][i];
+            holes   += BitCount(covered & ~r);
+            covered |= r;
+            height  += BitCount(covered);
+            bumps   += BitCount((covered ^ (covered >> 1)) & PAIRS);
+            walled   = r | WALLS;
+            trans   += BitCount((walled ^ (walled >> 1)) & EDGES);
+            full    += (r == FULLROW);
+        }
+        b->height[i] = height; b->holes[i] = holes; b->bumps[i] = bumps;
+        b->transitions[i] = trans; b->full[i] = full;
+    }
+}
+
+#ifdef EVAL_X86
+/* SSE2 KERNEL (4 boards a vector) */
+__attribute__((target("sse2")))
+static __m128i Count4(__m128i v)
+{
+    v = _mm_sub_epi32(v, _mm_and_si128(_mm_srli_epi32(v, 1), _mm_set1_epi32(0x55555555)));
+    v = _mm_add_epi32(_mm_and_si128(v, _mm_set1_epi32(0x33333333)),
+                      _mm_and_si128(_mm_srli_epi32(v, 2), _mm_set1_epi32(0x33333333)));
+    v = _mm_and_si128(_mm_add_epi32(v, _mm_srli_epi32(v, 4)), _mm_set1_epi32(0x0f0f0f0f));
+    v = _mm_add_epi32(v, _mm_srli_epi32(v, 8));
+    v = _mm_add_epi32(v, _mm_srli_epi32(v, 16));
+    return(_mm_and_si128(v, _mm_set1_epi32(0x3f)));
+}
+
+__attribute__((target("sse2")))
+static void SSE2(EvalBatch *b, int from, int to)
+{
+    const __m128i pairs = _mm_set1_epi32((int)PAIRS), walls = _mm_set1_epi32((int)WALLS),
+                  edges = _mm_set1_epi32((int)EDGES), fullrow = _mm_set1_epi32((int)FULLROW);
+    __m128i r, covered, walled, height, holes, bumps, trans, full;
+    int i, y;
+
+    for (i=from; i+4<=to; i+=4) {
+        covered = height = holes = bumps = trans = full = _mm_setzero_si128();
+        for (y=0; y<GAMEHEIGHT; y++) {
+            r       = _mm_loadu_si128((const __m128i *)&b->rows[y][i]);
+            holes   = _mm_add_epi32(holes, Count4(_mm_andnot_si128(r, covered)));
+            covered = _mm_or_si128(covered, r);
+            height  = _mm_add_epi32(height, Count4(covered));
+            bumps   = _mm_add_epi32(bumps, Count4(_mm_and_si128(
+                          _mm_xor_si128(covered, _mm_srli_epi32(covered, 1)), pairs)));
+            walled  = _mm_or_si128(r, walls);
+            trans   = _mm_add_epi32(trans, Count4(_mm_and_si128(
+                          _mm_xor_si128(walled, _mm_srli_epi32(walled, 1)), edges)));
+            full    = _mm_sub_epi32(full, _mm_cmpeq_epi32(r, fullrow));    /* -1 each */
+        }
+        _mm_storeu_si128((__m128i *)&b->height[i], height);
+        _mm_storeu_si128((__m128i *)&b->holes[i], holes);
+        _mm_storeu_si128((__m128i *)&b->bumps[i], bumps);
+        _mm_storeu_si128((__m128i *)&b->transitions[i], trans);
+        _mm_storeu_si128((__m128i *)&b->full[i], full);
+    }
+    Scalar(b, i, to);
+}
+
+/* AVX2 KERNEL (8 boards a vector) */
+__attribute__((target("avx2")))
+static __m256i Count8(__m256i v)
+{
+    v = _mm256_sub_epi32(v, _mm256_and_si256(_mm256_srli_epi32(v, 1), _mm256_set1_epi32(0x55555555)));
+    v = _mm256_add_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0x33333333)),
+                         _mm256_and_si256(_mm256_srli_epi32(v, 2), _mm256_set1_epi32(0x33333333)));
+    v = _mm256_and_si256(_mm256_add_epi32(v, _mm256_srli_epi32(v, 4)), _mm256_set1_epi32(0x0f0f0f0f));
+    v = _mm256_add_epi32(v, _mm256_srli_epi32(v, 8));
+    v = _mm256_add_epi32(v, _mm256_srli_epi32(v, 16));
+    return(_mm256_and_si256(v, _mm256_set1_epi32(0x3f)));
+}
+
+__attribute__((target("avx2")))
+static void AVX2(EvalBatch *b, int from, int to)
+{
+    const __m256i pairs = _mm256_set1_epi32((int)PAIRS), walls = _mm256_set1_epi32((int)WALLS),
+                  edges = _mm256_set1_epi32((int)EDGES), fullrow = _mm256_set1_epi32((int)FULLROW);
+    __m256i r, covered, walled, height, holes, bumps, trans, full;
+    int i, y;
+
+    for (i=from; i+8<=to; i+=8) {
+        covered = height = holes = bumps = trans = full = _mm256_setzero_si256();
+        for (y=0; y<GAMEHEIGHT; y++) {
+            r       = _mm256_loadu_si256((const __m256i *)&b->rows[y][i]);
+            holes   = _mm256_add_epi32(holes, Count8(_mm256_andnot_si256(r, covered)));
+            covered = _mm256_or_si256(covered, r);
+            height  = _mm256_add_epi32(height, Count8(covered));
+            bumps   = _mm256_add_epi32(bumps, Count8(_mm256_and_si256(
+                          _mm256_xor_si256(covered, _mm256_srli_epi32(covered, 1)), pairs)));
+            walled  = _mm256_or_si256(r, walls);
+            trans   = _mm256_add_epi32(trans, Count8(_mm256_and_si256(
+                          _mm256_xor_si256(walled, _mm256_srli_epi32(walled, 1)), edges)));
+            full    = _mm256_sub_epi32(full, _mm256_cmpeq_epi32(r, fullrow));
+        }
+        _mm256_storeu_si256((__m256i *)&b->height[i], height);
+        _mm256_storeu_si256((__m256i *)&b->holes[i], holes);
+        _mm256_storeu_si256((__m256i *)&b->bumps[i], bumps);
+        _mm256_storeu_si256((__m256i *)&b->transitions[i], trans);
+        _mm256_storeu_si256((__m256i *)&b->full[i], full);
+    }
+    SSE2(b, i, to);                     /* the last 4 or so */
+}
+#endif
+
+/* THE KERNELS, BEST LAST */
+static const struct { const char *name; EvalFunc *func; int lanes; } G_kernels[] = {
+    { "scalar", Scalar, 1 },
+#ifdef EVAL_X86
+    { "sse2",   SSE2,   4 },
+    { "avx2",   AVX2,   8 },
+#endif
+};
+#define NKERNELS ((int)(sizeof(G_kernels) / sizeof(G_kernels[0])))
+
+static int G_kernel = -1;               /* EvalUse()'s pick (-1: the best) */
+
+/* CAN THIS CPU RUN KERNEL k? */
+static int Runs(int k)
+{
+#ifdef EVAL_X86
+    if (G_kernels[k].func == SSE2) return(__builtin_cpu_supports("sse2"));
+    if (G_kernels[k].func == AVX2) return(__builtin_cpu_supports("avx2"));
+#endif
+    return(k == 0);
+}
+
+/* THE BEST KERNEL THIS CPU RUNS */
+static int Best(void)
+{
+    int k;
+    for (k=NKERNELS-1; k>0; k--)
+        if (Runs(k)) break;
+    return(k);
+}
+
+/* PICK A KERNEL BY NAME (NULL: the best this CPU runs)
+ *     Returns 0 if there's no such kernel here. Call before any
+ *     threads are running EvalRun(); without it, they use the best.
+ */
+int EvalUse(const char *kernel)
+{
+    int k;
+    if (!kernel) {
+        G_kernel = Best();
+        return(1);
+    }
+    for (k=0; k<NKERNELS; k++)
+        if (strcmp(kernel, G_kernels[k].name) == 0 && Runs(k)) {
+            G_kernel = k;
+            return(1);
+        }
+    return(0);
+}
+
+/* THE KERNEL'S NAME */
+const char *EvalKernel(void)
+{
+    return(G_kernels[G_kernel >= 0 ? G_kernel : Best()].name);
+}
+
+/* ADD A BOARD TO THE BATCH
+ *     'lines' is how many rows were completed getting to it. Returns
+ *     its index, or -1 if the batch is full.
+ */
+int EvalAdd(EvalBatch *b, const TetrisGame *g, int lines)
+{
+    int y;
+    if (b->n == EVALBATCH) return(-1);
+    for (y=0; y<GAMEHEIGHT; y++)
+        b->rows[y][b->n] = g->board[y] & FULLROW;
+    b->lines[b->n] = lines;
+    return(b->n++);
+}
+
+/* WORK OUT THE FEATURES OF EVERY BOARD IN THE BATCH
+ *     A last part-filled vector is padded out with empty boards, rather
+ *     than finished a board at a time.
+ */
+void EvalRun(EvalBatch *b)
+{
+    int k = (G_kernel >= 0) ? G_kernel : Best();
+    int end = (b->n + G_kernels[k].lanes - 1) / G_kernels[k].lanes * G_kernels[k].lanes;
+    int i, y;
+
+    for (y=0; y<GAMEHEIGHT; y++)
+        for (i=b->n; i<end; i++) b->rows[y][i] = 0;
+    G_kernels[k].func(b, 0, end);
+}
@@ -0,0 +1,44 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#ifndef EVAL_H
+#define EVAL_H
+#include "libtetris.h"
+
+/***********************************************************************
+ *
+ * EVAL - Board features for a batch of boards at once
+ *
+ *     The boards are kept structure-of-arrays: row y of every board
+ *     sits together in rows[y][], so one vector load picks up the same
+ *     row of 4 (SSE2) or 8 (AVX2) boards, and every feature is worked
+ *     out a row at a time for all of them in the same instructions.
+ *     The rows are the engine's own board[] words (see libtetris.h), as
+ *     TetrisStep() and TetrisPlace() leave them.
+ *
+ *     Which kernel runs is picked once from what the CPU has; the
+ *     scalar one works everywhere and every kernel gives the same
+ *     features (tetris-bench checks they do).
+ *
+ ***********************************************************************/
+
+#define EVALBATCH       64      /* boards per batch (a multiple of 8 lanes) */
+
+typedef struct {
+    int n;                              /* boards in the batch (0: empty it) */
+    Row rows[GAMEHEIGHT][EVALBATCH];    /* row y of board i is rows[y][i] */
+    int lines[EVALBATCH];               /* rows completed getting to each board */
+
+    /* EvalRun()'s features, per board */
+    int height[EVALBATCH],              /* sum of the column heights */
+        holes[EVALBATCH],               /* empty boxes with a box above them */
+        bumps[EVALBATCH],               /* sum of height steps between columns */
+        transitions[EVALBATCH],         /* filled/empty changes along the rows (walls filled) */
+        full[EVALBATCH];                /* completed rows still on the board */
+} EvalBatch;
+
+int  EvalAdd(EvalBatch *b, const TetrisGame *g, int lines);
+void EvalRun(EvalBatch *b);
+int  EvalUse(const char *kernel);
+const char *EvalKernel(void);
+
+#endif /*EVAL_H*/
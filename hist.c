@@ -0,0 +1,120 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <string.h>
+#include <time.h>
+#include "hist.h"
+
+#ifdef _WIN32
+#include <windows.h>                    /* QueryPerformanceCounter() */
+#endif
+
+/***********************************************************************
+ *
+ * HIST - Fixed size HDR style histograms (see hist.h)
+ *
+ ***********************************************************************/
+
+/* BUCKET A VALUE GOES IN
+ *     Below 2*HISTSUB: the value itself. Above, the top HISTSUBBITS+1
+ *     bits (the leading 1 and the next HISTSUBBITS) pick the bucket
+ *     within its power of two.
+ */
+static int Bucket(unsigned long long v)
+{
+    int shift = 0;
+    if (v < 2*HISTSUB) return((int)v);
+    while ((v >> shift) >= 2*HISTSUB) shift++;
+    return((shift + 1) * HISTSUB + (int)(v >> shift) - HISTSUB);
+}
+
+/* LOWEST VALUE IN A BUCKET */
+static unsigned long long BucketLow(int b)
+{
+    int shift = b / HISTSUB - 1;
+    if (b < 2*HISTSUB) return((unsigned long long)b);
+    return((unsigned long long)(b % HISTSUB + HISTSUB) << shift);
+}
+
+/* HIGHEST VALUE IN A BUCKET */
+static unsigned long long BucketHigh(int b)
+{
+    if (b < 2*HISTSUB) return((unsigned long long)b);
+    return(BucketLow(b) + (1ULL << (b / HISTSUB - 1)) - 1);
+}
+
+/* START AN EMPTY HISTOGRAM */
+void HistInit(Hist *h, const char *name, const char *unit)
+{
+    memset(h, 0, sizeof(Hist));
+    h->name = name;
+    h->unit = unit;
+}
+
+/* COUNT A VALUE (negative ones count as 0) */
+void HistAdd(Hist *h, long long value)
+{
+    unsigned long long v = (value < 0) ? 0 : (unsigned long long)value;
+    if (h->count == 0 || v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    h->count++;
+    h->sum += v;
+    h->buckets[Bucket(v)]++;
+}
+
+/* THE VALUE 'percent' OF THE COUNTS ARE AT OR BELOW
+ *     To within the bucket size: the highest value its bucket holds.
+ */
+long long HistPercentile(const Hist *h, double percent)
+{
+    unsigned long long want, seen = 0;
+    int b;
+
+    if (h->count == 0) return(0);
+    want = (unsigned long long)(h->count * percent / 100.0 + 0.5);
+    if (want < 1) want = 1;
+    for (b=0; b<HISTBUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= want)
+            return((long long)(BucketHigh(b) < h->max ? BucketHigh(b) : h->max));
+    }
+    return((long long)h->max);
+}
+
+/* WRITE A HISTOGRAM AS A JSON OBJECT
+ *     Summary percentiles, then the non-empty buckets as [low, count].
+ */
+void HistJSON(FILE *fp, const Hist *h)
+{
+    int b, first = 1;
+
+    fprintf(fp, "{\"name\": \"%s\", \"unit\": \"%s\", \"count\": %llu, "
+                "\"min\": %llu, \"mean\": %.1f, \"p50\": %lld, \"p90\": %lld, "
+                "\"p99\": %lld, \"p999\": %lld, \"max\": %llu,\n  \"buckets\": [",
+            h->name, h->unit, h->count, h->min,
+            h->count ? (double)h->sum / h->count : 0.0,
+            HistPercentile(h, 50), HistPercentile(h, 90),
+            HistPercentile(h, 99), HistPercentile(h, 99.9), h->max);
+    for (b=0; b<HISTBUCKETS; b++) {
+        if (!h->buckets[b]) continue;
+        fprintf(fp, "%s[%llu,%lu]", first ? "" : ",", BucketLow(b), h->buckets[b]);
+        first = 0;
+    }
+    fprintf(fp, "]}");
+}
+
+/* MONOTONIC CLOCK IN NANOSECONDS */
+long long HistNow(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return((long long)(now.QuadPart / freq.QuadPart) * 1000000000LL +
+           (long long)(now.QuadPart % freq.QuadPart) * 1000000000LL / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+#endif
+}
@@ -0,0 +1,37 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#ifndef HIST_H
+#define HIST_H
+#include <stdio.h>
+
+/***********************************************************************
+ *
+ * HIST - Fixed size HDR style histograms
+ *
+ *     Values (nanoseconds, bytes..) are counted in log-linear buckets:
+ *     the first 2*HISTSUB values each get their own, then every power
+ *     of two is split into HISTSUB equal buckets. So any value up to
+ *     2^63 is kept to within 1/HISTSUB (~1.6%), in a fixed amount of
+ *     memory, and adding one is a handful of shifts and an increment.
+ *
+ *     A Hist isn't locked; give each thread its own, or lock around it.
+ *
+ ***********************************************************************/
+
+#define HISTSUBBITS     6
+#define HISTSUB         (1 << HISTSUBBITS)          /* buckets per power of two */
+#define HISTBUCKETS     ((64 - HISTSUBBITS) * HISTSUB)
+
+typedef struct {
+    const char *name, *unit;            /* (for HistJSON()) */
+    unsigned long long count, sum, min, max;
+    unsigned long buckets[HISTBUCKETS];
+} Hist;
+
+void      HistInit(Hist *h, const char *name, const char *unit);
+void      HistAdd(Hist *h, long long value);
+long long HistPercentile(const Hist *h, double percent);
+void      HistJSON(FILE *fp, const Hist *h);
+long long HistNow(void);
+
+#endif /*HIST_H*/
@@ -0,0 +1,482 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <string.h>
+#include "libtetris.h"
+
+/***********************************************************************
+ *
+ * LIBTETRIS - Headless game engine for TETRIS
+ *
+ *     Game rules pulled out of tetris.c. Nothing in here does I/O,
+ *     sleeps, exits or touches global game state; see libtetris.h.
+ *
+ ***********************************************************************/
+
+#define ABS(a)          (((a)<0)?-(a):(a))
+#define ZSGN(a)         (((a)<0)?(-1):(a)>0?1:0) /* sign of a: -1, 0, 1 */
+
+#define SIDES(x,y) ((x)<0||(x)>=GAMEWIDTH)
+#define BOTT(x,y) ((y)>=GAMEHEIGHT)
+#define TOP(x,y)  ((y)<0)
+#define CLIP(x,y) (TOP(x,y)||BOTT(x,y)||SIDES(x,y))
+
+/* SHAPE TABLES
+ *     Generated from the shape icons in mkshapes.c at build time.
+ */
+#include "shapes.h"
+
+/* PER-GAME RANDOM NUMBERS
+ *     PCG32 (M.E. O'Neill, pcg-random.org): a 64 bit LCG whose output
+ *     is scrambled down to 32 bits. Kept in the game so games don't
+ *     share one sequence, and done in fixed width integer math so a
+ *     seed gives the same shapes on every machine and compiler.
+ */
+#define RNGMULT         6364136223846793005ULL
+#define RNGINC          1442695040888963407ULL
+#define RNGMASK         0xffffffffULL
+
+static unsigned long Random(TetrisGame *g)
+{
+    unsigned long long old = g->rng;
+    unsigned long xorshifted, rot;
+    g->rng     = old * RNGMULT + RNGINC;
+    xorshifted = (unsigned long)((((old >> 18) ^ old) >> 27) & RNGMASK);
+    rot        = (unsigned long)(old >> 59);
+    return(((xorshifted >> rot) | (xorshifted << ((32 - rot) & 31))) & RNGMASK);
+}
+
+/* SKIP THE RANDOM NUMBER STATE AHEAD 'n' NUMBERS
+ *     Jumps in O(log n) steps by squaring the LCG (F. Brown,
+ *     "Random Number Generation with Arbitrary Stride", 1994).
+ */
+static unsigned long long RandomSkip(unsigned long long state, unsigned long long n)
+{
+    unsigned long long mult = RNGMULT, inc = RNGINC,
+                       accmult = 1, accinc = 0;
+    for ( ; n; n >>= 1) {
+        if (n & 1) {
+            accmult *= mult;
+            accinc   = accinc * mult + inc;
+        }
+        inc  *= mult + 1;
+        mult *= mult;
+    }
+    return(accmult * state + accinc);
+}
+
+/* COME UP WITH A NEW SHAPE */
+static void MakeNewShape(TetrisGame *g)
+{
+    g->rotate    = 0;
+    g->shape     = g->nextshape;
+    g->x         = TetrisSpawn[g->shape][0];
+    g->y         = TetrisSpawn[g->shape][1];
+    g->nextshape = (int)(Random(g) % MAXSHAPES);
+}
+
+/* REBUILD THE SKYLINE FROM THE BOARD
+ *     The engine keeps height[] up to date itself; this is only
+ *     needed after changing board[] by hand.
+ */
+void TetrisIndexBoard(TetrisGame *g)
+{
+    int x,y;
+    for (x=0; x<GAMEWIDTH; x++) {
+        for (y=0; y<GAMEHEIGHT; y++)
+            if ((g->board[y] >> (x+FIELDSHIFT)) & 1) break;
+        g->height[x] = GAMEHEIGHT - y;
+    }
+}
+
+/* CLEAR THE GAME/INITIALIZE VARIABLES */
+void TetrisInit(TetrisGame *g, unsigned long long seed)
+{
+    int y;
+    for (y=0; y<GAMEHEIGHT; y++)
+        g->board[y] = 0;
+    TetrisIndexBoard(g);
+    g->nextshape = 0;
+    g->shape     = 0;
+    g->x         = 0;
+    g->y         = -3;
+    g->rotate    = 0;
+    g->rows      = 0;
+    g->pieces    = 0;
+    memset(g->hits, 0, sizeof(g->hits));
+    g->dead      = 0;
+    g->ncleared  = 0;
+    g->dirty     = ALLROWS;
+    g->seed      = seed;
+    g->rng       = (seed + RNGINC) * RNGMULT + RNGINC;  /* (PCG's seeding) */
+    MakeNewShape(g);     /* new shape */
+    MakeNewShape(g);     /* and another for preview */
+}
+
+/* CHECK IF SHAPE OVERLAPS OTHERS
+ * Returns
+ *      1 - hit left or right edges
+ *      2 - hit bottom or petrified boxes
+ */
+int TetrisCollision(const TetrisGame *g, int x, int y, int rotate)
+{
+    const Row *mask = TetrisMasks[g->shape][rotate];
+    const signed char *box = TetrisBoxes[g->shape][rotate];
+    Row bits;
+    int t, err=0;
+
+    /* A shape entirely off either side lands wholly in the guard bits,
+     * so clamping keeps the shift in range without changing the result.
+     */
+    if (x < -SHAPEMAX) x = -SHAPEMAX;
+    if (x > GAMEWIDTH) x = GAMEWIDTH;
+
+    for (t=box[1]; t<=box[3]; t++) {
+        if (BOTT(x,y+t)) {
+            return(2);                 /* hit bottom */
+        }
+        bits = mask[t] << (x+FIELDSHIFT);
+        if (bits & ~FULLROW) {         /* hit edge, but continue looking for */
+            err = 1;                   /* petrified shape or bottom */
+        }
+        if (!TOP(x,y+t) && (bits & g->board[y+t])) {
+            return(2);                 /* hit petrified shape */
+        }
+    }
+    return(err);
+}
+
+/* ROWS COVERED BY THE CURRENT SHAPE (bit y = row y) */
+static unsigned long ShapeRows(const TetrisGame *g)
+{
+    const signed char *box = TetrisBoxes[g->shape][g->rotate % 4];
+    unsigned long rows = 0;
+    int t;
+    for (t=box[1]; t<=box[3]; t++)
+        if (!TOP(0,g->y+t) && !BOTT(0,g->y+t))
+            rows |= 1UL << (g->y+t);
+    return(rows);
+}
+
+/* PETRIFY THE CURRENT SHAPE INTO PLACE
+ *     Only the shape's own rows and columns are touched: its row masks
+ *     are ORed into the board, and its highest box in each column
+ *     raises that column's skyline.
+ */
+static void PetrifyShape(TetrisGame *g)
+{
+    const Row *mask = TetrisMasks[g->shape][g->rotate % 4];
+    const signed char *box = TetrisBoxes[g->shape][g->rotate % 4];
+    const signed char (*cell)[2] = TetrisCells[g->shape][g->rotate % 4];
+    int t, y, x;
+    for (t=box[1]; t<=box[3]; t++) {
+        y = g->y + t;
+        if (TOP(0,y) || BOTT(0,y)) continue;
+        g->board[y] |= (mask[t] << (g->x+FIELDSHIFT)) & FULLROW;
+    }
+    for (t=0; t<SHAPEMAX; t++) {
+        x = g->x + cell[t][0];
+        y = g->y + cell[t][1];
+        if (!CLIP(x,y) && g->height[x] < GAMEHEIGHT - y)
+            g->height[x] = GAMEHEIGHT - y;
+    }
+}
+
+/* DELETE THE COMPLETED ROWS
+ *     rows[] are in ascending order. The rows from the lowest deleted
+ *     one up to the top of the stack are compacted down in one pass.
+ */
+static void DeleteCompletedRows(TetrisGame *g, int *rows, int trows)
+{
+    int x, y, h, t = trows-1, dst = rows[trows-1], top = GAMEHEIGHT;
+
+    for (x=0; x<GAMEWIDTH; x++)             /* top of the stack */
+        if (GAMEHEIGHT - g->height[x] < top) top = GAMEHEIGHT - g->height[x];
+
+    for (y=dst; y>=top; y--) {
+        if (t >= 0 && rows[t] == y) { t--; continue; }
+        g->board[dst--] = g->board[y];
+    }
+    while (dst >= top)
+        g->board[dst--] = 0;
+
+    /* Every column had a box in each deleted row, so skylines drop by
+     * trows, unless the column's top box went with them; then look
+     * further down for the new top.
+     */
+    for (x=0; x<GAMEWIDTH; x++) {
+        for (h = g->height[x] - trows;
+             h > 0 && !((g->board[GAMEHEIGHT-h] >> (x+FIELDSHIFT)) & 1); h--) { }
+        g->height[x] = h;
+    }
+}
+
+/* FIND COMPLETED ROWS, AND DELETE ACCORDINGLY
+ *     Only the rows the just-petrified shape covers can have completed.
+ */
+static void HandleCompletedRows(TetrisGame *g)
+{
+    const signed char *box = TetrisBoxes[g->shape][g->rotate % 4];
+    int t, y;
+
+    /* Find total completed rows */
+    g->ncleared = 0;
+    for (t=box[1]; t<=box[3]; t++) {
+        y = g->y + t;
+        if (!TOP(0,y) && !BOTT(0,y) && g->board[y]==FULLROW)
+            g->cleared[g->ncleared++] = y;
+    }
+
+    /* Found completed rows? Handle.. */
+    if (g->ncleared) {
+        DeleteCompletedRows(g, g->cleared, g->ncleared);
+        g->rows += g->ncleared;
+        g->dirty |= (2UL << g->cleared[g->ncleared-1]) - 1;    /* everything above moved down */
+    }
+}
+
+/* HOW FAR THE CURRENT SHAPE WOULD DROP STRAIGHT DOWN
+ *     Compares the shape's lowest box in each column with the skyline,
+ *     so it's constant time unless the shape has slid under an overhang.
+ *     (The ghost/hard drop position is g->y plus this.)
+ */
+int TetrisDropDistance(const TetrisGame *g)
+{
+    const signed char *bottom = TetrisBottoms[g->shape][g->rotate % 4];
+    const signed char *box = TetrisBoxes[g->shape][g->rotate % 4];
+    int r, d, drop = GAMEHEIGHT + SHAPEMAX;
+
+    for (r=box[0]; r<=box[2]; r++) {
+        if (bottom[r] < 0 || SIDES(g->x+r,0)) continue;
+        d = (GAMEHEIGHT - g->height[g->x+r]) - (g->y + bottom[r]) - 1;
+        if (d < 0) {                        /* under an overhang: step it down */
+            for (drop=0; !TetrisCollision(g, g->x, g->y+drop+1, g->rotate % 4); drop++) { }
+            return(drop);
+        }
+        if (d < drop) drop = d;
+    }
+    return(drop);
+}
+
+/* HANDLE SHAPE DRAWING/COLLISIONS/CLIPPING
+ *     Moves the current shape by the button events in 'in', undoing
+ *     events that would collide (so 'in' is left holding the moves that
+ *     were actually applied). A shape forced down onto the bottom or
+ *     petrified boxes is petrified, completed rows are deleted and the
+ *     next shape is started. Rows that need redrawing are added to
+ *     g->dirty.
+ *
+ *     Returns TETRIS_XXX flags describing what happened.
+ */
+int TetrisStep(TetrisGame *g, TetrisInput *in)
+{
+    int ret = 0;
+    unsigned long oldrows = ShapeRows(g);
+
+    g->ncleared = 0;
+    if (g->dead) return(TETRIS_DIED);
+
+    /* CHECK IF SHAPE TOUCHES OTHERS OR SCREEN BOTTOM IN REQUESTED ORIENTATION
+     */
+    while (1) {
+        switch(TetrisCollision(g, g->x + in->x,
+                                  g->y + in->y + in->yforce,
+                                  (g->rotate + in->rotate) % 4)) {
+            case 1: /* LEFT/RIGHT EDGE COLLISION */
+                /* Undo button events until no collision */
+                if (in->rotate!=0 || in->x!=0 || in->y!=0) g->hits[TETRIS_HITEDGE]++;
+                if (in->rotate!=0) { in->rotate -= ZSGN(in->rotate); continue; }
+                if (in->x!=0)      { in->x -= ZSGN(in->x); continue; }
+                if (in->y!=0)      { in->y -= ZSGN(in->y); continue; }
+                break;
+
+            case 2: /* BOTTOM OR PETRIFIED COLLISION */
+                /* Undo button events to avoid collision */
+                if (in->rotate!=0 || in->x!=0 || in->y!=0) g->hits[TETRIS_HITBLOCK]++;
+                if (ABS(in->rotate)!=0) { in->rotate -= ZSGN(in->rotate); continue; }
+                if (ABS(in->x)!=0)      { in->x      -= ZSGN(in->x);      continue; }
+                if (ABS(in->y)!=0)      { in->y      -= ZSGN(in->y);      continue; }
+
+                g->hits[TETRIS_HITLOCK]++;
+                if (g->y<1) { g->dead = 1; return(TETRIS_DIED); }
+
+                /* Petrify shape in old position and start the next one */
+                PetrifyShape(g);
+                HandleCompletedRows(g);
+                MakeNewShape(g);
+                g->pieces++;
+                ret |= TETRIS_LOCKED;
+                if (g->ncleared) ret |= TETRIS_ROWS;
+                break;
+
+            default:
+                g->hits[TETRIS_HITNONE]++;
+                break;
+        }
+        break;
+    }
+
+    /* APPLY THE REVISED MOVEMENTS TO THE MOVING SHAPE */
+    g->x      += in->x;
+    g->y      += (in->y + in->yforce);
+    g->rotate += in->rotate;
+    if (ret || in->x || in->y || in->yforce || in->rotate)
+        g->dirty |= oldrows | ShapeRows(g);
+    return(ret);
+}
+
+/* PLACEMENT SEARCH
+ *     Positions are indexed [y][x][rotation], with x and y offset so a
+ *     shape hanging off the left edge or above the top still fits.
+ */
+#define PLACEW          (GAMEWIDTH+SHAPEMAX)
+#define PLACEH          (GAMEHEIGHT+SHAPEMAX)
+#define PLACEINDEX(x,y,r) ((((y)+SHAPEMAX)*PLACEW + (x)+SHAPEMAX)*4 + (r))
+
+/* LIST WHERE THE CURRENT SHAPE CAN COME TO REST
+ *     Breadth first search from the shape's current position (a new
+ *     shape's start position) over the moves a single key or gravity
+ *     makes in TetrisStep(): left, right, rotate and down. As there, a
+ *     move that would collide is undone, so it just isn't followed.
+ *     A position the shape can't move down from is where gravity would
+ *     petrify it; those are the placements. Rotations that look the
+ *     same only count once, and placements that would end the game
+ *     are left out.
+ *
+ *     'list' needs room for TETRIS_MAXPLACEMENTS entries.
+ *     Returns how many placements were found.
+ */
+int TetrisPlacements(const TetrisGame *g, TetrisPlacement *list)
+{
+    static const signed char moves[3][3] = {    /* x,y,rotate */
+        { -1, 0, 0 }, { 1, 0, 0 }, { 0, 0, 1 }
+    };
+    unsigned char seen[PLACEH*PLACEW*4];        /* 1: queued, 2: listed */
+    TetrisPlacement queue[PLACEH*PLACEW*4], p;
+    int head = 0, tail = 0, n = 0, t, c;
+
+    if (g->dead || g->y < -SHAPEMAX || g->y >= GAMEHEIGHT) return(0);
+    memset(seen, 0, sizeof(seen));
+
+    p.x = g->x; p.y = g->y; p.rotate = g->rotate % 4;
+    seen[PLACEINDEX(p.x, p.y, p.rotate)] = 1;
+    queue[tail++] = p;
+
+    while (head < tail) {
+        p = queue[head++];
+        for (t=0; t<4; t++) {                   /* three key moves, then down */
+            TetrisPlacement m = p;
+            if (t < 3) {
+                m.x += moves[t][0];
+                m.rotate = (m.rotate + moves[t][2]) % 4;
+            } else {
+                m.y++;
+            }
+            if (TetrisCollision(g, m.x, m.y, m.rotate)) {
+                if (t < 3) continue;
+                /* can't go down: comes to rest here */
+                if (p.y < 1) continue;          /* ..and dies */
+                c = TetrisCanon[g->shape][p.rotate];
+                if (seen[PLACEINDEX(p.x, p.y, c)] & 2) continue;
+                seen[PLACEINDEX(p.x, p.y, c)] |= 2;
+                list[n] = p;
+                list[n++].rotate = c;
+                continue;
+            }
+            if (seen[PLACEINDEX(m.x, m.y, m.rotate)] & 1) continue;
+            seen[PLACEINDEX(m.x, m.y, m.rotate)] |= 1;
+            queue[tail++] = m;
+        }
+    }
+    return(n);
+}
+
+/* PETRIFY THE CURRENT SHAPE AT A PLACEMENT
+ *     Moves the shape to 'p' and lets gravity petrify it there, exactly
+ *     as TetrisStep() would.
+ *     Returns TETRIS_XXX flags.
+ */
+int TetrisPlace(TetrisGame *g, const TetrisPlacement *p)
+{
+    TetrisInput in = { 0, 0, 0, 1 };
+    g->dirty |= ShapeRows(g);                   /* where it was */
+    g->x      = p->x;
+    g->y      = p->y;
+    g->rotate = p->rotate;
+    return(TetrisStep(g, &in));
+}
+
+/* FIND THE NEXT KEY TOWARDS A PLACEMENT
+ *     Same search as TetrisPlacements(), but it stops at 'p' and walks
+ *     back to the first move taken, which is left in 'in' as one key's
+ *     worth of button events (zeroed if already there).
+ *     Returns how many moves 'p' is away, or -1 if it can't be reached.
+ */
+int TetrisRoute(const TetrisGame *g, const TetrisPlacement *p, TetrisInput *in)
+{
+    static const signed char moves[4][3] = {    /* x,y,rotate */
+        { -1, 0, 0 }, { 1, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 }
+    };
+    TetrisPlacement queue[PLACEH*PLACEW*4], q;
+    short from[PLACEH*PLACEW*4];                /* queue index moved from */
+    signed char move[PLACEH*PLACEW*4];          /* moves[] taken to get here */
+    unsigned char seen[PLACEH*PLACEW*4];
+    int head = 0, tail = 0, t, n;
+
+    in->x = in->y = in->rotate = in->yforce = 0;
+    if (g->dead || g->y < -SHAPEMAX || g->y >= GAMEHEIGHT) return(-1);
+    memset(seen, 0, sizeof(seen));
+
+    q.x = g->x; q.y = g->y; q.rotate = g->rotate % 4;
+    seen[PLACEINDEX(q.x, q.y, q.rotate)] = 1;
+    from[tail] = -1;
+    queue[tail++] = q;
+
+    while (head < tail) {
+        q = queue[head];
+        if (q.x == p->x && q.y == p->y && TetrisCanon[g->shape][q.rotate] == p->rotate) {
+            for (n=0, t=head; from[t] > 0; t=from[t]) n++;
+            if (from[t] == 0) {                 /* t is the first move */
+                in->x      = moves[move[t]][0];
+                in->y      = moves[move[t]][1];
+                in->rotate = moves[move[t]][2];
+                n++;
+            }
+            return(n);
+        }
+        for (t=0; t<4; t++) {
+            TetrisPlacement m = q;
+            m.x     += moves[t][0];
+            m.y     += moves[t][1];
+            m.rotate = (m.rotate + moves[t][2]) % 4;
+            if (TetrisCollision(g, m.x, m.y, m.rotate) ||
+                seen[PLACEINDEX(m.x, m.y, m.rotate)]) continue;
+            seen[PLACEINDEX(m.x, m.y, m.rotate)] = 1;
+            from[tail] = (short)head;
+            move[tail] = (signed char)t;
+            queue[tail++] = m;
+        }
+        head++;
+    }
+    return(-1);
+}
+
+/* SKIP 'n' SHAPES AHEAD IN THE GAME'S SHAPE SEQUENCE
+ *     Each new shape takes one random number, so this makes the next
+ *     'n' shapes the game would have come up with be passed over, in
+ *     O(log n) time. The current and next shapes are left alone.
+ */
+void TetrisSkip(TetrisGame *g, unsigned long long n)
+{
+    g->rng = RandomSkip(g->rng, n);
+}
+
+/* PEEK AT A SHAPE THAT'S COMING
+ *     Returns the shape the game will come up with 'n' shapes after
+ *     nextshape (0: the one after nextshape), without changing the game.
+ */
+int TetrisPeek(const TetrisGame *g, unsigned long long n)
+{
+    TetrisGame peek;
+    peek.rng = RandomSkip(g->rng, n);
+    return((int)(Random(&peek) % MAXSHAPES));
+}
@@ -0,0 +1,110 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#ifndef LIBTETRIS_H
+#define LIBTETRIS_H
+
+/***********************************************************************
+ *
+ * LIBTETRIS - Headless game engine for TETRIS
+ *
+ *     All game state lives in a TetrisGame struct, so any number of
+ *     independent games can run in one process. The engine does no I/O,
+ *     never sleeps and never exits; front ends feed it button events
+ *     with TetrisStep() and draw whatever state it leaves behind.
+ *
+ *     TetrisGame is plain data (no pointers), so a game can be copied
+ *     with a struct assignment, eg. to try out moves.
+ *
+ ***********************************************************************/
+
+/* SHAPE/SCREEN ORIENTATION */
+#define GAMEHEIGHT      20
+#define GAMEWIDTH       10
+#define MAXSHAPES       7
+#define SHAPEMAX        4       /* width/height of shape characters */
+
+/* BITBOARD ROWS
+ *     Each playfield row is kept as one machine word, bit (FIELDSHIFT+x)
+ *     being column x. The guard bits either side of the field let a shape
+ *     hang off an edge without negative shifts; any shape bit that lands
+ *     in them is an edge hit.
+ */
+#define FIELDSHIFT      SHAPEMAX
+#define FULLROW         ((((Row)1<<GAMEWIDTH)-1)<<FIELDSHIFT)
+
+typedef unsigned int Row;               /* one bitboard row */
+
+#define ALLROWS         ((1UL<<GAMEHEIGHT)-1)   /* dirty mask for every row */
+
+/* TetrisStep() RESULT FLAGS */
+#define TETRIS_LOCKED   0x01    /* shape petrified, next shape started */
+#define TETRIS_ROWS     0x02    /* completed rows deleted (see cleared[]) */
+#define TETRIS_DIED     0x04    /* shape petrified above the top: game over */
+
+/* COLLISION CASES TetrisStep() COUNTS IN hits[] */
+#define TETRIS_HITNONE  0       /* step moved the shape (after any undoing) */
+#define TETRIS_HITEDGE  1       /* a move undone at the left/right edge */
+#define TETRIS_HITBLOCK 2       /* a move undone against the bottom or boxes */
+#define TETRIS_HITLOCK  3       /* shape petrified */
+#define TETRIS_HITS     4
+
+/* BUTTON EVENTS FOR ONE STEP
+ *     Accumulated moves since the last step; yforce is gravity.
+ */
+typedef struct {
+    int x, y, rotate, yforce;
+} TetrisInput;
+
+/* ONE GAME */
+typedef struct {
+    Row board[GAMEHEIGHT];      /* petrified boxes, one word per row */
+    char height[GAMEWIDTH];     /* skyline: each column's top box above the floor */
+    int shape,                  /* current shape */
+        nextshape,              /* the next shape coming */
+        x, y, rotate,           /* current shape's orientation */
+        rows,                   /* completed rows (score) */
+        pieces,                 /* shapes petrified so far */
+        dead;                   /* 1 once the game is over */
+    int ncleared,               /* rows deleted by the last step.. */
+        cleared[SHAPEMAX];      /* ..and their y positions before deletion */
+    unsigned long dirty;        /* rows whose look changed (bit y = row y); */
+                                /* set by the engine, cleared by the front end */
+    unsigned long hits[TETRIS_HITS];    /* TetrisStep() collision cases seen */
+    unsigned long long seed,    /* what the game was started with.. */
+                       rng;     /* ..and the random number state for new shapes */
+} TetrisGame;
+
+/* A FINAL RESTING PLACE FOR THE CURRENT SHAPE (see TetrisPlacements()) */
+typedef struct {
+    signed char x, y, rotate;
+} TetrisPlacement;
+
+/* Most placements TetrisPlacements() can return */
+#define TETRIS_MAXPLACEMENTS    ((GAMEWIDTH+SHAPEMAX)*GAMEHEIGHT*4)
+
+/* SHAPE TABLES (built from the shape icons by mkshapes, see shapes.h) */
+/* Row masks: [shape][rotation][y], bit x = column x */
+extern const Row TetrisMasks[MAXSHAPES][4][SHAPEMAX];
+/* Column bottoms: [shape][rotation][x], lowest y in column x (-1: none) */
+extern const signed char TetrisBottoms[MAXSHAPES][4][SHAPEMAX];
+/* Boxes: [shape][rotation][box], x,y of each of the shape's boxes */
+extern const signed char TetrisCells[MAXSHAPES][4][SHAPEMAX][2];
+/* Bounding boxes: [shape][rotation], left,top,right,bottom (inclusive) */
+extern const signed char TetrisBoxes[MAXSHAPES][4][4];
+/* Start positions: [shape], x,y of a new shape */
+extern const signed char TetrisSpawn[MAXSHAPES][2];
+/* Same looking rotations: [shape][rotation], lowest rotation with the same boxes */
+extern const signed char TetrisCanon[MAXSHAPES][4];
+
+void TetrisInit(TetrisGame *g, unsigned long long seed);
+int  TetrisCollision(const TetrisGame *g, int x, int y, int rotate);
+int  TetrisStep(TetrisGame *g, TetrisInput *in);
+int  TetrisDropDistance(const TetrisGame *g);
+void TetrisIndexBoard(TetrisGame *g);
+int  TetrisPlacements(const TetrisGame *g, TetrisPlacement *list);
+int  TetrisPlace(TetrisGame *g, const TetrisPlacement *p);
+int  TetrisRoute(const TetrisGame *g, const TetrisPlacement *p, TetrisInput *in);
+void TetrisSkip(TetrisGame *g, unsigned long long n);
+int  TetrisPeek(const TetrisGame *g, unsigned long long n);
+
+#endif /*LIBTETRIS_H*/
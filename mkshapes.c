@@ -0,0 +1,236 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libtetris.h"
+
+/***********************************************************************
+ *
+ * MKSHAPES - Build time generator for shapes.h
+ *
+ *     The shape icons below are the only copy of the shapes. This turns
+ *     them into the packed tables libtetris.c compiles in, so nothing
+ *     is parsed at runtime:
+ *
+ *         mkshapes > shapes.h
+ *
+ *     The icons are checked first; a malformed one fails the build.
+ *
+ ***********************************************************************/
+
+/* SHAPE START POSITION: the 4x4 grid centered, just above the field */
+#define SPAWNX          (GAMEWIDTH/2 - SHAPEMAX/2)
+#define SPAWNY          (1 - SHAPEMAX)
+
+/* SHAPE TABLES (Indexing: [shape] [y] [rotation] [x]) */
+static const char *Gshapes[MAXSHAPES][4][4] = {    /* shape icons */
+  {
+    { "    ", "    ", "    ", "    " }, /* 4 rotated positions of each shape */
+    { " ## ", " ## ", " ## ", " ## " },
+    { " ## ", " ## ", " ## ", " ## " },
+    { "    ", "    ", "    ", "    " },
+  },{
+    { "    ", " #  ", " #  ", " #  " },
+    { "### ", " ## ", "### ", "##  " },
+    { " #  ", " #  ", "    ", " #  " },
+    { "    ", "    ", "    ", "    " },
+  },{
+    { "    ", " #  ", "    ", " #  " },
+    { "####", " #  ", "####", " #  " },
+    { "    ", " #  ", "    ", " #  " },
+    { "    ", " #  ", "    ", " #  " },
+  },{
+    { "    ", " #  ", "  # ", "##  " },
+    { "### ", " #  ", "### ", " #  " },
+    { "#   ", " ## ", "    ", " #  " },
+    { "    ", "    ", "    ", "    " },
+  },{
+    { "    ", " ## ", "#   ", " #  " },
+    { "### ", " #  ", "### ", " #  " },
+    { "  # ", " #  ", "    ", "##  " },
+    { "    ", "    ", "    ", "    " },
+  },{
+    { " ## ", " #  ", " ## ", " #  " },
+    { "##  ", " ## ", "##  ", " ## " },
+    { "    ", "  # ", "    ", "  # " },
+    { "    ", "    ", "    ", "    " },
+  },{
+    { "##  ", "  # ", "##  ", "  # " },
+    { " ## ", " ## ", " ## ", " ## " },
+    { "    ", " #  ", "    ", " #  " },
+    { "    ", "    ", "    ", "    " },
+  }
+};
+
+/* IS THERE A BOX AT x,y IN THIS SHAPE/ROTATION? */
+static int Box(int s, int r, int x, int y)
+{
+    return(Gshapes[s][y][r][x]=='#');
+}
+
+/* MAKE SURE EVERY ICON IS WELL FORMED
+ *     Each must be SHAPEMAX wide, use only ' ' and '#', and have
+ *     exactly SHAPEMAX boxes (TetrisCells[] has no room for more).
+ */
+static void CheckShapes(void)
+{
+    int s,r,x,y,n;
+    for (s=0; s<MAXSHAPES; s++)
+        for (r=0; r<4; r++) {
+            for (n=y=0; y<SHAPEMAX; y++) {
+                if (strlen(Gshapes[s][y][r]) != SHAPEMAX) {
+                    fprintf(stderr, "mkshapes: shape %d rotation %d row %d: "
+                                    "not %d wide\n", s, r, y, SHAPEMAX);
+                    exit(1);
+                }
+                for (x=0; x<SHAPEMAX; x++)
+                    switch (Gshapes[s][y][r][x]) {
+                        case '#': n++; break;
+                        case ' ':      break;
+                        default:
+                            fprintf(stderr, "mkshapes: shape %d rotation %d row %d: "
+                                            "bad character '%c'\n",
+                                            s, r, y, Gshapes[s][y][r][x]);
+                            exit(1);
+                    }
+            }
+            if (n != SHAPEMAX) {
+                fprintf(stderr, "mkshapes: shape %d rotation %d: "
+                                "%d boxes, expected %d\n", s, r, n, SHAPEMAX);
+                exit(1);
+            }
+        }
+}
+
+/* SHAPE ROW MASKS: bit x = column x */
+static void PrintMasks(void)
+{
+    int s,r,x,y;
+    Row mask;
+    printf("const Row TetrisMasks[MAXSHAPES][4][SHAPEMAX] = {\n");
+    for (s=0; s<MAXSHAPES; s++) {
+        printf("  {");
+        for (r=0; r<4; r++) {
+            printf(" {");
+            for (y=0; y<SHAPEMAX; y++) {
+                for (mask=0, x=0; x<SHAPEMAX; x++)
+                    if (Box(s,r,x,y)) mask |= (Row)1<<x;
+                printf("0x%x%s", mask, y<SHAPEMAX-1 ? "," : "");
+            }
+            printf("}%s", r<3 ? "," : "");
+        }
+        printf(" },\n");
+    }
+    printf("};\n\n");
+}
+
+/* LOWEST BOX IN EACH COLUMN (-1: none) */
+static void PrintBottoms(void)
+{
+    int s,r,x,y,b;
+    printf("const signed char TetrisBottoms[MAXSHAPES][4][SHAPEMAX] = {\n");
+    for (s=0; s<MAXSHAPES; s++) {
+        printf("  {");
+        for (r=0; r<4; r++) {
+            printf(" {");
+            for (x=0; x<SHAPEMAX; x++) {
+                for (b=-1, y=0; y<SHAPEMAX; y++)
+                    if (Box(s,r,x,y)) b = y;
+                printf("%2d%s", b, x<SHAPEMAX-1 ? "," : "");
+            }
+            printf("}%s", r<3 ? "," : "");
+        }
+        printf(" },\n");
+    }
+    printf("};\n\n");
+}
+
+/* EACH BOX'S x,y, top to bottom, left to right */
+static void PrintCells(void)
+{
+    int s,r,x,y,n;
+    printf("const signed char TetrisCells[MAXSHAPES][4][SHAPEMAX][2] = {\n");
+    for (s=0; s<MAXSHAPES; s++) {
+        printf("  {\n");
+        for (r=0; r<4; r++) {
+            printf("    {");
+            for (n=0, y=0; y<SHAPEMAX; y++)
+                for (x=0; x<SHAPEMAX; x++)
+                    if (Box(s,r,x,y))
+                        printf(" {%d,%d}%s", x, y, ++n<SHAPEMAX ? "," : "");
+            printf(" },\n");
+        }
+        printf("  },\n");
+    }
+    printf("};\n\n");
+}
+
+/* BOUNDING BOXES: left, top, right, bottom (inclusive) */
+static void PrintBoxes(void)
+{
+    int s,r,x,y,x0,y0,x1,y1;
+    printf("const signed char TetrisBoxes[MAXSHAPES][4][4] = {\n");
+    for (s=0; s<MAXSHAPES; s++) {
+        printf("  {");
+        for (r=0; r<4; r++) {
+            x0 = y0 = SHAPEMAX;
+            x1 = y1 = -1;
+            for (y=0; y<SHAPEMAX; y++)
+                for (x=0; x<SHAPEMAX; x++)
+                    if (Box(s,r,x,y)) {
+                        if (x<x0) x0 = x;
+                        if (x>x1) x1 = x;
+                        if (y<y0) y0 = y;
+                        if (y>y1) y1 = y;
+                    }
+            printf(" {%d,%d,%d,%d}%s", x0, y0, x1, y1, r<3 ? "," : "");
+        }
+        printf(" },\n");
+    }
+    printf("};\n\n");
+}
+
+/* ROTATIONS THAT LOOK THE SAME: lowest rotation with identical boxes */
+static void PrintCanon(void)
+{
+    int s,r,c,x,y,same;
+    printf("const signed char TetrisCanon[MAXSHAPES][4] = {\n");
+    for (s=0; s<MAXSHAPES; s++) {
+        printf("  {");
+        for (r=0; r<4; r++) {
+            for (c=0; c<r; c++) {
+                for (same=1, y=0; y<SHAPEMAX; y++)
+                    for (x=0; x<SHAPEMAX; x++)
+                        if (Box(s,r,x,y) != Box(s,c,x,y)) same = 0;
+                if (same) break;
+            }
+            printf("%d%s", c, r<3 ? "," : "");
+        }
+        printf("},\n");
+    }
+    printf("};\n\n");
+}
+
+/* WHERE EACH SHAPE STARTS: x,y of its 4x4 grid */
+static void PrintSpawn(void)
+{
+    int s;
+    printf("const signed char TetrisSpawn[MAXSHAPES][2] = {\n ");
+    for (s=0; s<MAXSHAPES; s++)
+        printf(" {%d,%d}%s", SPAWNX, SPAWNY, s<MAXSHAPES-1 ? "," : "");
+    printf("\n};\n");
+}
+
+int main(void)
+{
+    CheckShapes();
+    printf("/* shapes.h: generated by mkshapes from its shape icons; do not edit */\n\n");
+    PrintMasks();
+    PrintBottoms();
+    PrintCells();
+    PrintBoxes();
+    PrintCanon();
+    PrintSpawn();
+    return(0);
+}
@@ -0,0 +1,124 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "libtetris.h"
+
+/***********************************************************************
+ *
+ * TETRIS-PERFT - Count placement sequences with the engine
+ *
+ *     Like chess "perft": walks every sequence of placements
+ *     TetrisPlacements() offers, N shapes deep, and counts them.
+ *     A fixed seed (or shape list) makes the counts repeatable, so a
+ *     change in them means the movement or collision rules changed.
+ *     The nodes/sec figure is the move generator's throughput.
+ *
+ *         tetris-perft [--seed n] [--pieces OTILJSZ] [--expect count] depth
+ *
+ ***********************************************************************/
+
+#define SHAPENAMES "OTILJSZ"    /* shape letters, in TetrisMasks[] order */
+
+int   Gpieces[256];             /* --pieces: shapes to use, in order */
+int   Gnpieces = 0;             /* 0: use the game's own random shapes */
+long  Gnodes   = 0;             /* placements generated */
+
+/* GIVE THE GAME THE NEXT SHAPE FROM --pieces */
+void SetNextShape(TetrisGame *g, int ply)
+{
+    if (Gnpieces) g->nextshape = Gpieces[ply % Gnpieces];
+}
+
+/* COUNT PLACEMENT SEQUENCES 'depth' SHAPES DEEP
+ *     'ply' is how many shapes have been placed so far.
+ */
+long Perft(const TetrisGame *g, int depth, int ply)
+{
+    TetrisPlacement list[TETRIS_MAXPLACEMENTS];
+    TetrisGame next;
+    long count = 0;
+    int n, t;
+
+    n = TetrisPlacements(g, list);
+    Gnodes += n;
+    if (depth == 1) return(n);          /* leaves needn't be played */
+    for (t=0; t<n; t++) {
+        next = *g;
+        TetrisPlace(&next, &list[t]);
+        SetNextShape(&next, ply+2);
+        count += Perft(&next, depth-1, ply+1);
+    }
+    return(count);
+}
+
+/* PARSE --pieces LETTERS */
+void ParsePieces(const char *s)
+{
+    const char *p;
+    for (Gnpieces=0; *s && Gnpieces<256; s++) {
+        if (!(p = strchr(SHAPENAMES, *s))) {
+            fprintf(stderr, "tetris-perft: bad shape '%c' (use %s)\n", *s, SHAPENAMES);
+            exit(1);
+        }
+        Gpieces[Gnpieces++] = (int)(p - SHAPENAMES);
+    }
+}
+
+void Usage(void)
+{
+    fprintf(stderr, "usage: tetris-perft [--seed n] [--pieces %s] "
+                    "[--expect count] depth\n", SHAPENAMES);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    TetrisGame g;
+    unsigned long long seed = 1;
+    long count = 0, expect = -1;
+    int t, d, depth = 0;
+    clock_t start;
+    double secs;
+
+    for (t=1; t<argc; t++) {
+        if (strcmp(argv[t], "--seed") == 0 && t+1 < argc)
+            seed = strtoull(argv[++t], NULL, 10);
+        else if (strcmp(argv[t], "--pieces") == 0 && t+1 < argc)
+            ParsePieces(argv[++t]);
+        else if (strcmp(argv[t], "--expect") == 0 && t+1 < argc)
+            expect = atol(argv[++t]);
+        else if (argv[t][0] != '-' && depth == 0)
+            depth = atoi(argv[t]);
+        else
+            Usage();
+    }
+    if (depth < 1) Usage();
+
+    TetrisInit(&g, seed);
+    if (Gnpieces) {
+        g.shape = Gpieces[0];
+        g.x     = TetrisSpawn[g.shape][0];
+        g.y     = TetrisSpawn[g.shape][1];
+        SetNextShape(&g, 1);
+    }
+
+    printf("depth %12s %12s %10s %12s\n", "sequences", "nodes", "secs", "nodes/sec");
+    for (d=1; d<=depth; d++) {
+        Gnodes = 0;
+        start  = clock();
+        count  = Perft(&g, d, 0);
+        secs   = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("%5d %12ld %12ld %10.3f %12.0f\n", d, count, Gnodes, secs,
+               secs > 0 ? Gnodes / secs : 0.0);
+        fflush(stdout);
+    }
+
+    if (expect >= 0 && count != expect) {
+        fprintf(stderr, "tetris-perft: expected %ld sequences, got %ld\n", expect, count);
+        return(1);
+    }
+    return(0);
+}
@@ -0,0 +1,289 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>                     /* sysconf() */
+#include "plan.h"
+
+/***********************************************************************
+ *
+ * PLAN - Picks placements by Monte Carlo rollouts (see plan.h)
+ *
+ *     PlanChoose() posts the decision and bumps G_decision; the workers
+ *     and the caller first take the placements off it one at a time,
+ *     so each gets at least one rollout, then each goes round them all
+ *     on its own 'til the deadline. Threads keep their own sums and
+ *     counts (in their arenas, so no cache line is shared) and the
+ *     caller adds them up once everyone's done.
+ *
+ ***********************************************************************/
+
+#define HORIZON     8                   /* shapes played after the placement */
+#define DIED        -1000.0             /* rollout score if the game ends */
+#define ARENASIZE   (64*1024)           /* a thread's memory for one decision */
+
+/* BUMP ALLOCATOR
+ *     Alloc() just moves 'used' along; Reset() frees everything at once.
+ */
+typedef struct {
+    char  *base;
+    size_t used, size;
+} Arena;
+
+static void ArenaInit(Arena *a, size_t size)
+{
+    if (!(a->base = malloc(size))) {
+        perror("plan: malloc");
+        exit(1);
+    }
+    a->used = 0;
+    a->size = size;
+}
+
+static void ArenaReset(Arena *a)
+{
+    a->used = 0;
+}
+
+/* 'n' BYTES, 16 BYTE ALIGNED (the arena's too small: a bug, so exit) */
+static void *ArenaAlloc(Arena *a, size_t n)
+{
+    void *p;
+    n = (n + 15) & ~(size_t)15;
+    if (a->used + n > a->size) {
+        fprintf(stderr, "plan: arena of %lu bytes is too small\n", (unsigned long)a->size);
+        exit(1);
+    }
+    p = a->base + a->used;
+    a->used += n;
+    return(p);
+}
+
+/* ONE THREAD'S STATE */
+typedef struct {
+    Arena  arena;
+    double *sum;                        /* per placement, this decision.. */
+    long   *count;                      /* ..(in the arena) */
+    TetrisPlacement *list;              /* rollout scratch (in the arena) */
+    EvalBatch *batch;
+    int    *which;                      /* batch board -> list[] */
+} PlanThread;
+
+/* THE DECISION BEING MADE */
+typedef struct {
+    const TetrisGame      *g;
+    const BotWeights      *w;
+    const TetrisPlacement *list;
+    int  n,                             /* placements */
+         next,                          /* first pass: next one to take */
+         done;                          /* threads finished */
+    long long deadline;                 /* Now() to stop at */
+    unsigned long long seed;            /* rollouts' shapes come from this */
+} PlanJob;
+
+static PlanJob         G_planjob;
+static PlanThread     *G_threads = NULL;    /* [0] is PlanChoose()'s caller */
+static int             G_nthreads = 0;
+static pthread_mutex_t G_planlock = PTHREAD_MUTEX_INITIALIZER,
+                       G_planbusy = PTHREAD_MUTEX_INITIALIZER;  /* one decision at a time */
+static pthread_cond_t  G_planwork = PTHREAD_COND_INITIALIZER,
+                       G_plandone = PTHREAD_COND_INITIALIZER;
+static unsigned long   G_decision = 0;
+static unsigned long long G_planrng = 0x6A09E667F3BCC908ULL;   /* decisions' seeds */
+
+/* MONOTONIC NANOSECONDS */
+static long long Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/* NEXT RANDOM NUMBER FROM 'rng' (splitmix64) */
+static unsigned long long Random(unsigned long long *rng)
+{
+    unsigned long long z = (*rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return(z ^ (z >> 31));
+}
+
+/* RATE THE BATCH'S BOARDS, KEEPING THE BEST (pick: its list[] index) */
+static void Pick(PlanThread *pt, const BotWeights *w, double *best, int *pick)
+{
+    EvalBatch *b = pt->batch;
+    double score;
+    int i;
+    EvalRun(b);
+    for (i=0; i<b->n; i++)
+        if ((score = BotRate(b, i, w)) > *best || *pick < 0) {
+            *best = score;
+            *pick = pt->which[i];
+        }
+    b->n = 0;
+}
+
+/* PLAY ONE ROLLOUT OF PLACEMENT p
+ *     The rollout's game gets random number state 'seed', so the
+ *     engine draws the shapes after the known next one as usual, just
+ *     not the real game's. Each shape goes where it rates best right
+ *     away; the score is the rating of the board HORIZON shapes on,
+ *     counting every row completed since g.
+ */
+static double Rollout(PlanThread *pt, const TetrisGame *g, const BotWeights *w,
+                      const TetrisPlacement *p, unsigned long long seed)
+{
+    TetrisGame r, r1;
+    EvalBatch *b = pt->batch;
+    double best = 0;
+    int n, t, k, pick = -1;
+
+    r = *g;
+    r.rng = seed;
+    if (TetrisPlace(&r, p) & TETRIS_DIED) return(DIED);
+    for (k=0; k<HORIZON; k++) {
+        if ((n = TetrisPlacements(&r, pt->list)) == 0) return(DIED);
+        for (pick=-1, t=0; t<n; t++) {
+            r1 = r;
+            if (TetrisPlace(&r1, &pt->list[t]) & TETRIS_DIED) continue;
+            pt->which[b->n] = t;
+            EvalAdd(b, &r1, r1.rows - g->rows);
+            if (b->n == EVALBATCH) Pick(pt, w, &best, &pick);
+        }
+        if (b->n) Pick(pt, w, &best, &pick);
+        if (pick < 0) return(DIED);             /* every placement ends the game */
+        TetrisPlace(&r, &pt->list[pick]);
+    }
+    return(best);                               /* (the last board placed was picked) */
+}
+
+/* DO ONE THREAD'S SHARE OF THE DECISION
+ *     Called with G_planlock held; rollouts run unlocked. The placements
+ *     are played out against the same shape sequences (the first pass's
+ *     seed, then one per lap of each thread), so the differences in
+ *     their means are down to the placements more than to the luck of
+ *     the draw.
+ */
+static void WorkJob(int self)
+{
+    PlanJob *j = &G_planjob;
+    PlanThread *pt = &G_threads[self];
+    unsigned long long lap = j->seed + ((unsigned long long)(self + 1) << 32),
+                       first = j->seed, seed;
+    int c;
+
+    ArenaReset(&pt->arena);
+    pt->sum   = ArenaAlloc(&pt->arena, j->n * sizeof(double));
+    pt->count = ArenaAlloc(&pt->arena, j->n * sizeof(long));
+    pt->list  = ArenaAlloc(&pt->arena, TETRIS_MAXPLACEMENTS * sizeof(TetrisPlacement));
+    pt->batch = ArenaAlloc(&pt->arena, sizeof(EvalBatch));
+    pt->which = ArenaAlloc(&pt->arena, EVALBATCH * sizeof(int));
+    memset(pt->sum, 0, j->n * sizeof(double));
+    memset(pt->count, 0, j->n * sizeof(long));
+    pt->batch->n = 0;
+
+    while (j->next < j->n) {                    /* everyone gets one */
+        c = j->next++;
+        pthread_mutex_unlock(&G_planlock);
+        pt->sum[c] += Rollout(pt, j->g, j->w, &j->list[c], first);
+        pt->count[c]++;
+        pthread_mutex_lock(&G_planlock);
+    }
+    pthread_mutex_unlock(&G_planlock);
+    for (c=0; Now() < j->deadline; c = (c+1) % j->n) {
+        if (c == 0) seed = Random(&lap);
+        pt->sum[c] += Rollout(pt, j->g, j->w, &j->list[c], seed);
+        pt->count[c]++;
+    }
+    pthread_mutex_lock(&G_planlock);
+    if (++j->done == G_nthreads) pthread_cond_signal(&G_plandone);
+}
+
+static void *Worker(void *arg)
+{
+    int self = (int)(long)arg;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&G_planlock);
+    while (1) {
+        while (G_decision == seen)
+            pthread_cond_wait(&G_planwork, &G_planlock);
+        seen = G_decision;
+        WorkJob(self);
+    }
+    return(NULL);
+}
+
+/* START THE PLANNING THREADS
+ *     nthreads counts the caller of PlanChoose(), which works too;
+ *     0 is one per CPU. Call once, before PlanChoose(). Returns how
+ *     many threads there are.
+ */
+int PlanStart(int nthreads)
+{
+    pthread_t tid;
+    int t;
+
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+    if (!(G_threads = calloc(nthreads, sizeof(PlanThread)))) {
+        perror("plan: calloc");
+        exit(1);
+    }
+    for (t=0; t<nthreads; t++)
+        ArenaInit(&G_threads[t].arena, ARENASIZE);
+    for (t=1; t<nthreads; t++) {
+        if (pthread_create(&tid, NULL, Worker, (void *)(long)t) != 0) break;
+        pthread_detach(tid);
+    }
+    G_nthreads = t;
+    return(t);
+}
+
+/* PICK THE PLACEMENT WITH THE BEST MEAN ROLLOUT, IN ABOUT 'budgetms'
+ *     Every placement gets at least one rollout, however small the
+ *     budget. Returns the rollouts played, or 0 if there's nowhere to
+ *     go. Calls from several threads take turns.
+ */
+long PlanChoose(const TetrisGame *g, const BotWeights *w, long budgetms,
+                TetrisPlacement *best)
+{
+    TetrisPlacement list[TETRIS_MAXPLACEMENTS];
+    double mean, bestmean = 0;
+    long count, rollouts = 0;
+    int n, c, t, b = -1;
+
+    if ((n = TetrisPlacements(g, list)) == 0) return(0);
+    if (!G_threads) PlanStart(1);
+
+    pthread_mutex_lock(&G_planbusy);
+    pthread_mutex_lock(&G_planlock);
+    G_planjob.g = g; G_planjob.w = w; G_planjob.list = list; G_planjob.n = n;
+    G_planjob.next = G_planjob.done = 0;
+    G_planjob.deadline = Now() + budgetms * 1000000LL;
+    G_planjob.seed = Random(&G_planrng);
+    G_decision++;
+    pthread_cond_broadcast(&G_planwork);
+    WorkJob(0);                                 /* lend a hand */
+    while (G_planjob.done < G_nthreads)
+        pthread_cond_wait(&G_plandone, &G_planlock);
+    pthread_mutex_unlock(&G_planlock);
+
+    for (c=0; c<n; c++) {
+        for (mean=0, count=0, t=0; t<G_nthreads; t++) {
+            mean  += G_threads[t].sum[c];
+            count += G_threads[t].count[c];
+        }
+        mean /= count;
+        rollouts += count;
+        if (b < 0 || mean > bestmean) {
+            bestmean = mean;
+            b = c;
+        }
+    }
+    pthread_mutex_unlock(&G_planbusy);
+    *best = list[b];
+    return(rollouts);
+}
@@ -0,0 +1,28 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#ifndef PLAN_H
+#define PLAN_H
+#include "libtetris.h"
+#include "bot.h"
+
+/***********************************************************************
+ *
+ * PLAN - Picks placements by Monte Carlo rollouts (POSIX threads)
+ *
+ *     Each placement of the current shape is scored by playing it out
+ *     many times: place it, then play a few more shapes with the bot's
+ *     one shape greedy choice, the shapes past the known next one drawn
+ *     at random just as the engine draws them. A placement's score is
+ *     the mean of its rollouts' final board ratings. Rollouts go on
+ *     until the decision's time budget is spent, on every thread.
+ *
+ *     Each thread has its own arena for a decision's working memory,
+ *     emptied at the start of the next, so rollouts never malloc().
+ *
+ ***********************************************************************/
+
+int  PlanStart(int nthreads);
+long PlanChoose(const TetrisGame *g, const BotWeights *w, long budgetms,
+                TetrisPlacement *best);
+
+#endif /*PLAN_H*/
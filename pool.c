@@ -0,0 +1,213 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>                     /* sysconf() */
+#include "pool.h"
+
+/***********************************************************************
+ *
+ * POOL - Work stealing thread pool (POSIX threads)
+ *
+ *     See pool.h. Deques are short and tasks are coarse (eg. a whole
+ *     game), so each deque just has its own mutex. The pool mutex only
+ *     guards the counts idle workers sleep on.
+ *
+ ***********************************************************************/
+
+typedef struct {
+    PoolFunc func;
+    void    *arg;
+} PoolTask;
+
+/* ONE WORKER'S TASKS: the owner takes from the tail, thieves from the head */
+typedef struct {
+    pthread_mutex_t lock;
+    PoolTask *tasks;
+    int head, tail, size;
+} PoolDeque;
+
+struct Pool {
+    int             nthreads;
+    pthread_t      *threads;
+    PoolDeque      *deques;
+    pthread_mutex_t lock;
+    pthread_cond_t  work,               /* tasks were queued, or quit */
+                    idle;               /* pending went to 0 */
+    long            queued,             /* tasks in the deques */
+                    pending;            /* tasks not yet finished */
+    unsigned        next;               /* round robin for outside submits */
+    int             quit;
+    int             started;            /* threads that have a worker number */
+};
+
+/* HOW MANY CPUS THIS MACHINE HAS */
+int PoolCPUs(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return(n < 1 ? 1 : (int)n);
+}
+
+/* HOW MANY WORKER THREADS THE POOL HAS */
+int PoolThreads(const Pool *p)
+{
+    return(p->nthreads);
+}
+
+/* ADD A TASK TO THE TAIL OF A DEQUE */
+static void PushTask(PoolDeque *d, PoolFunc func, void *arg)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->head > 0 && d->head == d->tail)      /* empty: start over */
+        d->head = d->tail = 0;
+    if (d->tail == d->size) {
+        d->size  = d->size ? d->size * 2 : 64;
+        d->tasks = realloc(d->tasks, d->size * sizeof(PoolTask));
+        if (!d->tasks) { perror("pool: realloc"); exit(1); }
+    }
+    d->tasks[d->tail].func = func;
+    d->tasks[d->tail].arg  = arg;
+    d->tail++;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* TAKE A TASK FROM A DEQUE'S TAIL (owner) OR HEAD (thief)
+ *     Returns 0 if it was empty.
+ */
+static int TakeTask(Pool *p, PoolDeque *d, int steal, PoolTask *t)
+{
+    int ok = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail) {
+        *t = steal ? d->tasks[d->head++] : d->tasks[--d->tail];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    if (ok) {
+        pthread_mutex_lock(&p->lock);
+        p->queued--;
+        pthread_mutex_unlock(&p->lock);
+    }
+    return(ok);
+}
+
+/* FIND WORK: OUR OWN NEWEST TASK, ELSE SOMEONE ELSE'S OLDEST */
+static int FindTask(Pool *p, int me, PoolTask *t)
+{
+    int i;
+    if (TakeTask(p, &p->deques[me], 0, t)) return(1);
+    for (i=1; i<p->nthreads; i++)
+        if (TakeTask(p, &p->deques[(me+i) % p->nthreads], 1, t)) return(1);
+    return(0);
+}
+
+static void *Worker(void *arg)
+{
+    Pool *p = (Pool*)arg;
+    PoolTask t;
+    int me;
+
+    pthread_mutex_lock(&p->lock);
+    me = p->started++;
+    pthread_mutex_unlock(&p->lock);
+
+    while (1) {
+        if (FindTask(p, me, &t)) {
+            t.func(t.arg, me);
+            pthread_mutex_lock(&p->lock);
+            if (--p->pending == 0) pthread_cond_broadcast(&p->idle);
+            pthread_mutex_unlock(&p->lock);
+            continue;
+        }
+        pthread_mutex_lock(&p->lock);
+        while (!p->queued && !p->quit)
+            pthread_cond_wait(&p->work, &p->lock);
+        if (p->quit && !p->queued) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+    return(NULL);
+}
+
+/* START A POOL
+ *     nthreads = 0 starts one worker per CPU.
+ */
+Pool *PoolCreate(int nthreads)
+{
+    Pool *p = calloc(1, sizeof(Pool));
+    int t;
+
+    if (nthreads <= 0) nthreads = PoolCPUs();
+    if (!p ||
+        !(p->threads = calloc(nthreads, sizeof(pthread_t))) ||
+        !(p->deques  = calloc(nthreads, sizeof(PoolDeque)))) {
+        perror("pool: calloc");
+        exit(1);
+    }
+    p->nthreads = nthreads;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    for (t=0; t<nthreads; t++)
+        pthread_mutex_init(&p->deques[t].lock, NULL);
+    for (t=0; t<nthreads; t++)
+        if (pthread_create(&p->threads[t], NULL, Worker, p) != 0) {
+            perror("pool: pthread_create");
+            exit(1);
+        }
+    return(p);
+}
+
+/* QUEUE A TASK
+ *     A task submitting more work passes its own worker number, so the
+ *     new task goes on its own deque; others pass -1.
+ */
+void PoolSubmit(Pool *p, int worker, PoolFunc func, void *arg)
+{
+    pthread_mutex_lock(&p->lock);
+    if (worker < 0 || worker >= p->nthreads)
+        worker = (int)(p->next++ % p->nthreads);
+    p->pending++;
+    pthread_mutex_unlock(&p->lock);
+
+    PushTask(&p->deques[worker], func, arg);
+
+    pthread_mutex_lock(&p->lock);
+    p->queued++;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* WAIT FOR EVERY SUBMITTED TASK TO FINISH */
+void PoolWait(Pool *p)
+{
+    pthread_mutex_lock(&p->lock);
+    while (p->pending)
+        pthread_cond_wait(&p->idle, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* FINISH THE QUEUED TASKS, THEN STOP THE THREADS AND FREE THE POOL */
+void PoolDestroy(Pool *p)
+{
+    int t;
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    for (t=0; t<p->nthreads; t++)
+        pthread_join(p->threads[t], NULL);
+    for (t=0; t<p->nthreads; t++) {
+        pthread_mutex_destroy(&p->deques[t].lock);
+        free(p->deques[t].tasks);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->idle);
+    free(p->deques);
+    free(p->threads);
+    free(p);
+}
@@ -0,0 +1,27 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#ifndef POOL_H
+#define POOL_H
+
+/***********************************************************************
+ *
+ * POOL - Work stealing thread pool (POSIX threads)
+ *
+ *     Each worker has its own deque of tasks. It runs the newest task
+ *     from its own deque and, when that's empty, steals the oldest
+ *     task from another worker's. Tasks may submit more tasks.
+ *
+ ***********************************************************************/
+
+typedef void (*PoolFunc)(void *arg, int worker);   /* worker: 0..nthreads-1 */
+
+typedef struct Pool Pool;
+
+Pool *PoolCreate(int nthreads);
+void  PoolSubmit(Pool *p, int worker, PoolFunc func, void *arg);
+void  PoolWait(Pool *p);
+void  PoolDestroy(Pool *p);
+int   PoolThreads(const Pool *p);
+int   PoolCPUs(void);
+
+#endif /*POOL_H*/
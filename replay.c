@@ -0,0 +1,421 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "replay.h"
+
+/***********************************************************************
+ *
+ * REPLAY - Compact game recordings
+ *
+ *     See replay.h for the file layout.
+ *
+ ***********************************************************************/
+
+#define VERSION         1
+#define HEADERLEN       13      /* "TRPL" version seed */
+#define TRAILERLEN      8       /* footer-offset "TRIX" */
+#define KEYFRAME        0       /* v >> 4 of a key 0 record */
+#define END             1
+#define ZIGZAG(a)       ((unsigned long)(((a)<0) ? -2L*(a)-1 : 2L*(a)))
+#define UNZIGZAG(a)     ((long)(((a)&1) ? -(long)(((a)+1)/2) : (long)((a)/2)))
+
+/*** WRITING ***/
+
+static void PutByte(ReplayWriter *w, int c)
+{
+    putc(c, w->fp);
+    w->offset++;
+}
+
+static void PutVarint(ReplayWriter *w, unsigned long v)
+{
+    while (v >= 0x80) {
+        PutByte(w, (int)(v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    PutByte(w, (int)v);
+}
+
+/* FIXED SIZE LITTLE ENDIAN INTEGER */
+static void PutFixed(ReplayWriter *w, unsigned long long v, int bytes)
+{
+    while (bytes--) {
+        PutByte(w, (int)(v & 0xff));
+        v >>= 8;
+    }
+}
+
+/* WRITE ONE EVENT */
+static void PutEvent(ReplayWriter *w, long ms, int key, int more)
+{
+    PutVarint(w, (unsigned long)(ms - w->ms) << 4 | (more ? 8 : 0) | key);
+    w->ms = ms;
+}
+
+/* WRITE A KEYFRAME OF THE GAME'S STATE, AND REMEMBER WHERE IT IS */
+static void PutKeyframe(ReplayWriter *w, const TetrisGame *g)
+{
+    int y;
+    if (w->nkeys == w->maxkeys) {
+        w->maxkeys = w->maxkeys ? w->maxkeys * 2 : 64;
+        if (!(w->keys = realloc(w->keys, w->maxkeys * sizeof(ReplayKey)))) {
+            w->maxkeys = w->nkeys = 0;  /* (no index: ReplayOpen() scans) */
+            return;
+        }
+    }
+    w->keys[w->nkeys].ms     = w->ms;
+    w->keys[w->nkeys].steps  = w->steps;
+    w->keys[w->nkeys].offset = w->offset;
+    w->nkeys++;
+
+    PutVarint(w, KEYFRAME << 4);
+    PutVarint(w, (unsigned long)w->ms);
+    PutVarint(w, (unsigned long)w->steps);
+    for (y=0; y<GAMEHEIGHT; y++)
+        PutVarint(w, (unsigned long)(g->board[y] >> FIELDSHIFT));
+    PutVarint(w, (unsigned long)g->shape);
+    PutVarint(w, (unsigned long)g->nextshape);
+    PutVarint(w, ZIGZAG(g->x));
+    PutVarint(w, ZIGZAG(g->y));
+    PutVarint(w, (unsigned long)(g->rotate % 4));
+    PutVarint(w, (unsigned long)g->rows);
+    PutVarint(w, (unsigned long)g->pieces);
+    PutVarint(w, (unsigned long)g->dead);
+    PutFixed(w, g->rng, 8);
+}
+
+/* START RECORDING A NEW GAME
+ *     Returns -1 (errno set) if the file can't be created.
+ */
+int ReplayCreate(ReplayWriter *w, const char *path, const TetrisGame *g)
+{
+    memset(w, 0, sizeof(*w));
+    if (!(w->fp = fopen(path, "wb"))) return(-1);
+    fwrite("TRPL", 1, 4, w->fp);
+    w->offset = 4;
+    PutByte(w, VERSION);
+    PutFixed(w, g->seed, 8);
+    return(0);
+}
+
+/* RECORD ONE STEP
+ *     'in' is what was given to TetrisStep() (before it undid anything)
+ *     at 'ms' msecs into the game, and 'g' the game after the step.
+ */
+void ReplayStep(ReplayWriter *w, long ms, const TetrisInput *in, const TetrisGame *g)
+{
+    int keys[4], counts[4], t, n;
+
+    keys[0] = (in->x < 0) ? REPLAY_LEFT : REPLAY_RIGHT;  counts[0] = abs(in->x);
+    keys[1] = REPLAY_DOWN;                               counts[1] = abs(in->y);
+    keys[2] = REPLAY_ROTATE;                             counts[2] = abs(in->rotate);
+    keys[3] = REPLAY_GRAVITY;                            counts[3] = abs(in->yforce);
+    for (n=t=0; t<4; t++) n += counts[t];
+    if (!w->fp || n == 0) return;
+
+    if (ms < w->ms) ms = w->ms;                 /* (clock went backwards?) */
+    for (t=0; t<4; t++)
+        while (counts[t]--)
+            PutEvent(w, ms, keys[t], --n > 0);
+    if (++w->steps % REPLAYKEYSTEPS == 0)
+        PutKeyframe(w, g);
+}
+
+/* FINISH THE RECORDING: WRITE THE KEYFRAME INDEX AND CLOSE
+ *     Returns -1 (errno set) if writing failed.
+ */
+int ReplayClose(ReplayWriter *w)
+{
+    long t, footer = w->offset, ms = 0, steps = 0, offset = 0;
+    int err;
+
+    if (!w->fp) return(0);
+    PutVarint(w, END << 4);
+    PutVarint(w, (unsigned long)w->nkeys);
+    for (t=0; t<w->nkeys; t++) {
+        PutVarint(w, (unsigned long)(w->keys[t].ms     - ms));
+        PutVarint(w, (unsigned long)(w->keys[t].steps  - steps));
+        PutVarint(w, (unsigned long)(w->keys[t].offset - offset));
+        ms     = w->keys[t].ms;
+        steps  = w->keys[t].steps;
+        offset = w->keys[t].offset;
+    }
+    PutFixed(w, (unsigned long long)footer, 4);
+    fwrite("TRIX", 1, 4, w->fp);
+    err = ferror(w->fp);
+    if (fclose(w->fp) != 0) err = 1;
+    free(w->keys);
+    memset(w, 0, sizeof(*w));
+    return(err ? -1 : 0);
+}
+
+/*** READING ***/
+
+/* READ A VARINT AT *pos (up to 'end')
+ *     Returns 0 if it's cut short or too long for an unsigned long
+ *     (32 bits on Windows).
+ */
+static int GetVarint(const unsigned char *data, long end, long *pos, unsigned long *v)
+{
+    int shift;
+    *v = 0;
+    for (shift=0; *pos < end && shift < (int)(sizeof(*v)*8); shift += 7) {
+        unsigned char c = data[(*pos)++];
+        *v |= (unsigned long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return(1);
+    }
+    return(0);
+}
+
+static unsigned long long GetFixed(const unsigned char *data, long pos, int bytes)
+{
+    unsigned long long v = 0;
+    while (bytes--)
+        v = (v << 8) | data[pos + bytes];
+    return(v);
+}
+
+/* READ A KEYFRAME BODY AT *pos INTO 'key', AND THE STATE INTO 'g' (if not NULL)
+ *     Returns 0 if it's cut short.
+ */
+static int GetKeyframe(const ReplayReader *r, long *pos, ReplayKey *key, TetrisGame *g)
+{
+    unsigned long v[GAMEHEIGHT+10];
+    int t;
+    for (t=0; t<GAMEHEIGHT+10; t++)
+        if (!GetVarint(r->data, r->end, pos, &v[t])) return(0);
+    if (*pos + 8 > r->end) return(0);
+    key->ms    = (long)v[0];
+    key->steps = (long)v[1];
+    if (g) {
+        TetrisInit(g, r->seed);
+        for (t=0; t<GAMEHEIGHT; t++)
+            g->board[t] = ((Row)v[2+t] << FIELDSHIFT) & FULLROW;
+        TetrisIndexBoard(g);
+        t = GAMEHEIGHT+2;
+        g->shape     = (int)(v[t++] % MAXSHAPES);
+        g->nextshape = (int)(v[t++] % MAXSHAPES);
+        g->x         = (int)UNZIGZAG(v[t]); t++;
+        g->y         = (int)UNZIGZAG(v[t]); t++;
+        g->rotate    = (int)(v[t++] % 4);
+        g->rows      = (int)v[t++];
+        g->pieces    = (int)v[t++];
+        g->dead      = (int)v[t++];
+        g->rng       = GetFixed(r->data, *pos, 8);
+    }
+    *pos += 8;
+    return(1);
+}
+
+/* READ THE INDEX AT THE END OF THE FILE
+ *     Returns 0 if there isn't a good one: keyframes must be in order,
+ *     and between the header and the index.
+ */
+static int GetIndex(ReplayReader *r)
+{
+    unsigned long v, n, t, d[3];
+    long pos, footer;
+    ReplayKey k = { 0, 0, 0 };
+
+    if (r->size < HEADERLEN + TRAILERLEN ||
+        memcmp(r->data + r->size - 4, "TRIX", 4) != 0) return(0);
+    footer = (long)GetFixed(r->data, r->size - TRAILERLEN, 4);
+    if (footer < HEADERLEN || footer >= r->size - TRAILERLEN) return(0);
+
+    pos = footer;
+    if (!GetVarint(r->data, r->size, &pos, &v) || v != END << 4 ||
+        !GetVarint(r->data, r->size, &pos, &n) ||
+        n > (unsigned long)(r->size / 3)) return(0);
+    if (n && !(r->keys = malloc(n * sizeof(ReplayKey)))) return(0);
+    for (t=0; t<n; t++) {
+        if (!GetVarint(r->data, r->size, &pos, &d[0]) ||
+            !GetVarint(r->data, r->size, &pos, &d[1]) ||
+            !GetVarint(r->data, r->size, &pos, &d[2]) ||
+            d[0] > (unsigned long)(LONG_MAX - k.ms) ||
+            d[1] > (unsigned long)(LONG_MAX - k.steps) ||
+            d[2] >= (unsigned long)(footer - k.offset) ||
+            (t > 0 && d[2] == 0)) break;
+        k.ms     += (long)d[0];
+        k.steps  += (long)d[1];
+        k.offset += (long)d[2];
+        if (k.offset < r->start) break;
+        r->keys[t] = k;
+    }
+    if (t < n) {
+        free(r->keys);
+        r->keys = NULL;
+        return(0);
+    }
+    r->nkeys = (long)n;
+    r->end   = footer;
+    return(1);
+}
+
+/* NO INDEX: SCAN THE RECORDS FOR THE KEYFRAMES
+ *     Stops at END, or at the first record that's cut short.
+ */
+static void ScanIndex(ReplayReader *r)
+{
+    unsigned long v;
+    long pos = r->start, at, max = 0;
+    ReplayKey k;
+
+    r->end = r->size;
+    while (at = pos, GetVarint(r->data, r->end, &pos, &v)) {
+        if (v & 7) continue;                    /* an event */
+        if ((v >> 4) != KEYFRAME) break;        /* END */
+        if (!GetKeyframe(r, &pos, &k, NULL)) break;
+        if (r->nkeys == max) {
+            ReplayKey *keys = realloc(r->keys, (max = max ? max*2 : 64) * sizeof(ReplayKey));
+            if (!keys) break;
+            r->keys = keys;
+        }
+        k.offset = at;
+        r->keys[r->nkeys++] = k;
+    }
+    r->end = at;
+}
+
+/* READ A WHOLE FILE INTO MEMORY (free() it when done)
+ *     Returns -1 (errno set) on failure.
+ */
+int ReplayLoad(const char *path, unsigned char **data, long *size)
+{
+    FILE *fp = fopen(path, "rb");
+    long n = 0, max = 0, got;
+    unsigned char *buf = NULL, *more;
+
+    if (!fp) return(-1);
+    do {
+        if (n == max) {
+            max = max ? max * 2 : 65536;
+            if (!(more = realloc(buf, max))) { free(buf); fclose(fp); return(-1); }
+            buf = more;
+        }
+        n += (got = (long)fread(buf + n, 1, max - n, fp));
+    } while (got > 0);
+    if (ferror(fp)) { free(buf); fclose(fp); return(-1); }
+    fclose(fp);
+    *data = buf;
+    *size = n;
+    return(0);
+}
+
+/* GET READY TO PLAY A REPLAY FROM 'data'
+ *     Returns -1 if it isn't a replay file.
+ */
+int ReplayOpen(ReplayReader *r, const unsigned char *data, long size)
+{
+    memset(r, 0, sizeof(*r));
+    if (size < HEADERLEN || memcmp(data, "TRPL", 4) != 0 || data[4] != VERSION)
+        return(-1);
+    r->data  = data;
+    r->size  = size;
+    r->seed  = GetFixed(data, 5, 8);
+    r->start = r->pos = HEADERLEN;
+    if (!GetIndex(r)) ScanIndex(r);
+    return(0);
+}
+
+/* START THE GAME OVER FROM THE BEGINNING */
+void ReplayStart(ReplayReader *r, TetrisGame *g)
+{
+    TetrisInit(g, r->seed);
+    r->pos   = r->start;
+    r->ms    = 0;
+    r->steps = 0;
+}
+
+/* READ THE NEXT STEP'S BUTTON EVENTS
+ *     'in' gets the input to give TetrisStep(), and 'ms' when it
+ *     happened. Keyframes along the way are skipped.
+ *     Returns 1, or 0 at the end of the replay.
+ */
+int ReplayNext(ReplayReader *r, TetrisInput *in, long *ms)
+{
+    unsigned long v;
+    long pos = r->pos, t = r->ms;
+    ReplayKey k;
+
+    in->x = in->y = in->rotate = in->yforce = 0;
+    while (GetVarint(r->data, r->end, &pos, &v)) {
+        if ((v & 7) == 0) {                     /* keyframe, or END */
+            if ((v >> 4) != KEYFRAME || !GetKeyframe(r, &pos, &k, NULL)) break;
+            continue;
+        }
+        t += (long)(v >> 4);
+        switch (v & 7) {
+            case REPLAY_LEFT:    in->x--;      break;
+            case REPLAY_RIGHT:   in->x++;      break;
+            case REPLAY_DOWN:    in->y++;      break;
+            case REPLAY_ROTATE:  in->rotate++; break;
+            case REPLAY_GRAVITY: in->yforce++; break;
+        }
+        if (!(v & 8)) {                         /* last event of the step */
+            r->pos = pos;
+            r->ms  = *ms = t;
+            r->steps++;
+            return(1);
+        }
+    }
+    return(0);
+}
+
+/* JUMP TO 'ms' MSECS INTO THE GAME
+ *     Restores the last keyframe at or before 'ms' into 'g', then runs
+ *     the steps up to 'ms' through the engine. If the index sends it
+ *     somewhere that isn't the keyframe it describes, the index is
+ *     thrown away and the keyframes found by scanning instead.
+ *     Returns the steps run since the keyframe.
+ */
+int ReplaySeek(ReplayReader *r, TetrisGame *g, long ms)
+{
+    long lo, hi, mid, pos, t;
+    unsigned long v;
+    TetrisInput in;
+    ReplayKey k;
+    int n = 0, scanned = 0;
+
+    while (1) {
+        for (lo=0, hi=r->nkeys; lo < hi; ) {    /* first keyframe after 'ms' */
+            mid = (lo + hi) / 2;
+            if (r->keys[mid].ms <= ms) lo = mid + 1;
+            else hi = mid;
+        }
+        ReplayStart(r, g);
+        if (lo == 0) break;
+        pos = r->keys[lo-1].offset;
+        if (pos >= r->start && pos < r->end &&
+            GetVarint(r->data, r->end, &pos, &v) && v == KEYFRAME << 4 &&
+            GetKeyframe(r, &pos, &k, g) &&
+            k.ms == r->keys[lo-1].ms && k.steps == r->keys[lo-1].steps) {
+            r->pos   = pos;
+            r->ms    = k.ms;
+            r->steps = k.steps;
+            break;
+        }
+        ReplayStart(r, g);                      /* (g may be half restored) */
+        if (scanned++) break;
+        ReplayFree(r);
+        ScanIndex(r);
+    }
+    while (1) {
+        ReplayReader save = *r;
+        if (!ReplayNext(r, &in, &t)) break;
+        if (t > ms) { *r = save; break; }
+        TetrisStep(g, &in);
+        n++;
+    }
+    g->dirty = ALLROWS;
+    return(n);
+}
+
+/* FREE WHAT ReplayOpen() ALLOCATED (not the data) */
+void ReplayFree(ReplayReader *r)
+{
+    free(r->keys);
+    r->keys  = NULL;
+    r->nkeys = 0;
+}
@@ -0,0 +1,89 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#ifndef REPLAY_H
+#define REPLAY_H
+#include <stdio.h>
+#include "libtetris.h"
+
+/***********************************************************************
+ *
+ * REPLAY - Compact game recordings
+ *
+ *     A replay is the game's seed, then every TetrisStep() it took as
+ *     a stream of (time, key) events. The engine is deterministic, so
+ *     that's enough to play the game again. Every REPLAYKEYSTEPS steps
+ *     a keyframe holds the whole engine state, and an index of them
+ *     at the end of the file lets a player jump to any time by only
+ *     replaying the steps since the keyframe before it.
+ *
+ *     File layout (integers are LEB128 varints unless noted):
+ *
+ *         "TRPL" version(byte) seed(8 bytes, little endian)
+ *         records..
+ *         END index.. footer-offset(4 bytes, little endian) "TRIX"
+ *
+ *     A record is one varint v:
+ *
+ *         v & 7      key: REPLAY_XXX code; 0 for KEYFRAME/END below
+ *         v & 8      more: the next event belongs to the same step
+ *         v >> 4     msecs since the previous event (key != 0), or
+ *                    what follows (key == 0): 0 keyframe, 1 END
+ *
+ *     A keyframe is msecs, steps, the board rows, then the shape and
+ *     score fields, and the random number state (8 bytes). The index
+ *     is the keyframe count, then each keyframe's msecs, steps and
+ *     file offset, delta encoded. A file cut short (eg. by a crash)
+ *     has no index; ReplayOpen() then finds the keyframes itself.
+ *
+ ***********************************************************************/
+
+/* EVENT KEYS (same codes tetris.c's HandleButtons() uses) */
+#define REPLAY_DOWN     1
+#define REPLAY_LEFT     2
+#define REPLAY_RIGHT    3
+#define REPLAY_ROTATE   4
+#define REPLAY_GRAVITY  5       /* the gravity timer forcing the shape down */
+
+#define REPLAYKEYSTEPS  200     /* steps between keyframes */
+
+/* WHERE A KEYFRAME IS */
+typedef struct {
+    long ms, steps, offset;
+} ReplayKey;
+
+/* RECORDING A GAME */
+typedef struct {
+    FILE      *fp;
+    long       offset,          /* bytes written */
+               ms,              /* time of the last event */
+               steps;           /* steps recorded */
+    ReplayKey *keys;            /* keyframes written.. */
+    long       nkeys, maxkeys;  /* ..how many, and room for */
+} ReplayWriter;
+
+/* PLAYING ONE BACK (from the whole file in memory) */
+typedef struct {
+    const unsigned char *data;
+    long       size,
+               start,           /* offset of the first record */
+               end,             /* offset of END (or the end of data) */
+               pos,             /* next record */
+               ms,              /* time of the last step read */
+               steps;           /* steps read */
+    unsigned long long seed;
+    ReplayKey *keys;
+    long       nkeys;
+} ReplayReader;
+
+int  ReplayCreate(ReplayWriter *w, const char *path, const TetrisGame *g);
+void ReplayStep(ReplayWriter *w, long ms, const TetrisInput *in, const TetrisGame *g);
+int  ReplayClose(ReplayWriter *w);
+
+int  ReplayLoad(const char *path, unsigned char **data, long *size);
+int  ReplayOpen(ReplayReader *r, const unsigned char *data, long size);
+void ReplayStart(ReplayReader *r, TetrisGame *g);
+int  ReplayNext(ReplayReader *r, TetrisInput *in, long *ms);
+int  ReplaySeek(ReplayReader *r, TetrisGame *g, long ms);
+void ReplayFree(ReplayReader *r);
+
+#endif /*REPLAY_H*/
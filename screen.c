@@ -0,0 +1,640 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "screen.h"
+
+/***********************************************************************
+ *
+ * SCREEN - Draws a game on one VT100/Wyse terminal (see screen.h)
+ *
+ ***********************************************************************/
+
+/* SHAPE/SCREEN ORIENTATION */
+#define TOPOFFSET       2
+#define PREVIEWYOFFSET  15
+#define PREVIEWXOFFSET  47
+#define LEFTOFFSET      20
+
+#define ABS(a)          (((a)<0)?-(a):(a))
+
+static const char *G_window[] = {
+"\t\t ::::::::::::::::::::::::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::              ",
+"\t\t ::                    ::    ..........",
+"\t\t ::                    ::    :        :",
+"\t\t ::                    ::    :        :",
+"\t\t ::                    ::    :        :",
+"\t\t ::                    ::    :        :",
+"\t\t ::                    ::    :        :",
+"\t\t ::                    ::    :        :",
+"\t\t ::                    ::    :........:",
+"\t\t ::                    ::              ",
+"\t\t ::::::::::::::::::::::::    Rows =    ",
+NULL
+};
+
+/* TERMINAL BACKENDS
+ *     All that differs between terminal types, picked once per Screen
+ *     by ScreenTerm(): the pixel glyphs and clear screen sequence,
+ *     pre-encoded with their lengths, and encoders for each cursor
+ *     motion. An encoder leaves its bytes in m[] and returns their
+ *     length, or -1 if the terminal can't do that motion (cheaply).
+ */
+struct ScreenBackend {
+    const char *name;
+    const char *pixel[2];               /* PIXOFF, PIXON glyphs.. */
+    int  pixlen[2];                     /* ..and their lengths */
+    const char *clear;                  /* clear screen, cursor home */
+    int  clearlen;
+    int  (*xy)(char *m, int x, int y);  /* cursor address (1 based) */
+    int  (*up)(char *m, int n),         /* cursor motion, n > 0 */
+         (*down)(char *m, int n),
+         (*right)(char *m, int n),
+         (*left)(char *m, int n);
+};
+
+/* APPEND A DECIMAL NUMBER (n > 0) */
+static int Decimal(char *m, int n)
+{
+    char d[12];
+    int len = 0, t = 0;
+    do d[t++] = (char)('0' + n % 10); while ((n /= 10) > 0);
+    while (t > 0) m[len++] = d[--t];
+    return(len);
+}
+
+/* REPEAT A CONTROL CHARACTER n TIMES (if fewer than 8) */
+static int Repeat(char *m, int c, int n)
+{
+    if (n >= 8) return(-1);
+    memset(m, c, n);
+    m[n] = 0;
+    return(n);
+}
+
+/* ANSI RELATIVE MOTION: ESC [ n <dir> (ESC [ <dir> for 1) */
+static int AnsiMove(char *m, int n, char dir)
+{
+    int len = 2;
+    m[0] = 033; m[1] = '[';
+    if (n != 1) len += Decimal(m+len, n);
+    m[len++] = dir;
+    m[len] = 0;
+    return(len);
+}
+
+/* VT100/ANSI (vt100, xterm, IRIS-ANSI, IBMPC-ANSI..) */
+static int AnsiXY(char *m, int x, int y)
+{
+    int len = 2;
+    m[0] = 033; m[1] = '[';
+    if (y != 1 || x != 1) len += Decimal(m+len, y);
+    if (x != 1) { m[len++] = ';'; len += Decimal(m+len, x); }
+    m[len++] = 'H';
+    m[len] = 0;
+    return(len);
+}
+static int AnsiUp(char *m, int n)    { return(AnsiMove(m, n, 'A')); }
+static int AnsiDown(char *m, int n)  { return(AnsiMove(m, n, 'B')); }
+static int AnsiRight(char *m, int n) { return(AnsiMove(m, n, 'C')); }
+static int AnsiLeft(char *m, int n)  { return((n < 4) ? Repeat(m, '\b', n) : AnsiMove(m, n, 'D')); }
+
+/* WYSE: no relative down (^J is a linefeed) */
+static int WyseXY(char *m, int x, int y)
+{
+    m[0] = 033; m[1] = '=';
+    m[2] = (char)(0x20+y-1); m[3] = (char)(0x20+x-1);
+    m[4] = 0;
+    return(4);
+}
+static int WyseUp(char *m, int n)    { return(Repeat(m, 0x0b, n)); }      /* ^K */
+static int WyseDown(char *m, int n)  { (void)m; (void)n; return(-1); }
+static int WyseRight(char *m, int n) { return(Repeat(m, 0x0c, n)); }      /* ^L */
+static int WyseLeft(char *m, int n)  { return(Repeat(m, '\b', n)); }
+
+#define VTPIXEL         "\33[7m##\33[0m"
+#define VTCLEAR         "\33[2J\33[1;1H\r"
+#define WYPIXEL         "\33`6\33)##\33("
+#define WYCLEAR         "\33(\32\r\36"
+#define LEN(str)        ((int)sizeof(str)-1)
+
+static const ScreenBackend G_vt100 = {
+    "vt100", { "  ", VTPIXEL }, { 2, LEN(VTPIXEL) }, VTCLEAR, LEN(VTCLEAR),
+    AnsiXY, AnsiUp, AnsiDown, AnsiRight, AnsiLeft
+};
+static const ScreenBackend G_wyse = {
+    "wyse", { "  ", WYPIXEL }, { 2, LEN(WYPIXEL) }, WYCLEAR, LEN(WYCLEAR),
+    WyseXY, WyseUp, WyseDown, WyseRight, WyseLeft
+};
+static const ScreenBackend G_virtual = {       /* (VT100 output, for a VTerm) */
+    "virtual", { "  ", VTPIXEL }, { 2, LEN(VTPIXEL) }, VTCLEAR, LEN(VTCLEAR),
+    AnsiXY, AnsiUp, AnsiDown, AnsiRight, AnsiLeft
+};
+
+/* PICK THE BACKEND FOR A TERMINAL TYPE ($TERM; NULL: vt100) */
+void ScreenTerm(Screen *s, const char *term)
+{
+    s->term = term;
+    if (term && strncmp(term, "wy", 2) == 0)            s->be = &G_wyse;
+    else if (term && strcmp(term, G_virtual.name) == 0) s->be = &G_virtual;
+    else                                                s->be = &G_vt100;
+}
+
+/* SET UP A SCREEN
+ *     'out' is outmax bytes for building output in; a frame that fits
+ *     goes to the writer in one piece.
+ */
+void ScreenInit(Screen *s, const char *term, char *out, int outmax,
+                ScreenWriter *writer, void *arg)
+{
+    memset(s, 0, sizeof(*s));
+    ScreenTerm(s, term);
+    s->curx     = s->cury = -1;
+    s->lastrows = s->lastnext = -1;
+    s->out      = out;
+    s->outmax   = outmax;
+    s->writer   = writer;
+    s->arg      = arg;
+    memset(s->front, PIXUNKNOWN, sizeof(s->front));
+}
+
+/* SET UP A SCREEN THAT DRAWS ON A VIRTUAL TERMINAL */
+void ScreenInitVirtual(Screen *s, VTerm *vt, char *out, int outmax)
+{
+    VTermInit(vt);
+    ScreenInit(s, G_virtual.name, out, outmax, VTermWrite, vt);
+}
+
+/* HAND THE OUTPUT BUILT SO FAR TO THE WRITER */
+static void Send(Screen *s)
+{
+    if (s->outlen == 0) return;
+    s->framewrites += s->writer(s->arg, s->out, s->outlen);
+    s->framebytes  += s->outlen;
+    s->outlen = 0;
+}
+
+/* APPEND BYTES TO THE OUTPUT */
+static void Put(Screen *s, const char *str, int len)
+{
+    if (s->outlen + len > s->outmax) Send(s);   /* oversized frame: send what we have */
+    memcpy(s->out+s->outlen, str, len);
+    s->outlen += len;
+}
+
+/* APPEND A STRING TO THE OUTPUT */
+void ScreenPuts(Screen *s, const char *str)
+{
+    Put(s, str, (int)strlen(str));
+}
+
+/* APPEND FORMATTED OUTPUT */
+void ScreenPrintf(Screen *s, const char *fmt, ...)
+{
+    char str[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(str, sizeof(str), fmt, ap);
+    va_end(ap);
+    ScreenPuts(s, str);
+}
+
+/* SEND THE FRAME TO THE TERMINAL
+ *     Byte/write() counts are kept for the frame, and in total.
+ */
+void ScreenFlush(Screen *s)
+{
+    s->framebytes = s->framewrites = 0;
+    Send(s);
+    ++s->frames;
+    s->totalbytes  += s->framebytes;
+    s->totalwrites += s->framewrites;
+}
+
+/* CLEAR THE TERMINAL SCREEN */
+void ScreenClear(Screen *s)
+{
+    Put(s, s->be->clear, s->be->clearlen);
+    s->curx = s->cury = 1;
+}
+
+/* WHAT'S ON THE TERMINAL AT x,y, IF WE KNOW
+ *     Returns the pixel (PIXOFF/PIXON) last drawn at the start of a
+ *     playfield cell, or -1 if x,y isn't one (or we don't know).
+ */
+static int ShownPixel(const Screen *s, int x, int y)
+{
+    x -= LEFTOFFSET;
+    y -= TOPOFFSET;
+    if (x < 0 || x >= GAMEWIDTH*2 || (x & 1) || y < 0 || y >= GAMEHEIGHT)
+        return(-1);
+    if (s->front[y][x/2] == PIXUNKNOWN) return(-1);
+    return(s->front[y][x/2]);
+}
+
+/* CHEAPEST HORIZONTAL CURSOR MOTION ON ROW y FROM COLUMN cx TO x
+ *     Leaves the bytes in m[] (MOVEMAX), choosing among cursor
+ *     forward/back, backspaces, carriage return, and overwriting the
+ *     cells in between with what's already shown there.
+ *     Returns the length of m[], or -1 if there's no short way.
+ */
+#define MOVEMAX 32
+static int HorizMove(const Screen *s, char *m, int cx, int x, int y)
+{
+    const ScreenBackend *be = s->be;
+    char t[MOVEMAX];
+    int n = ABS(x - cx), len = -1, tlen = 0, p;
+
+    m[0] = 0;
+    if (x == cx) return(0);
+    if (x > cx) {
+        /* CURSOR FORWARD */
+        len = be->right(m, n);
+
+        /* OVERWRITE CELLS IN BETWEEN */
+        for (; cx < x; cx += 2) {
+            if ((p = ShownPixel(s, cx, y)) < 0) return(len);
+            if (tlen + be->pixlen[p] >= (len < 0 ? MOVEMAX : len)) return(len);
+            memcpy(t+tlen, be->pixel[p], be->pixlen[p]);
+            tlen += be->pixlen[p];
+        }
+        if (cx == x) { memcpy(m, t, tlen); m[len = tlen] = 0; }
+    } else {
+        /* BACKSPACES/CURSOR BACK */
+        len = be->left(m, n);
+
+        /* CARRIAGE RETURN, THEN FORWARD FROM COLUMN 1 */
+        n = HorizMove(s, t+1, 1, x, y);
+        t[0] = '\r';
+        if (n >= 0 && (len < 0 || n+1 < len)) { memcpy(m, t, n+1); m[len = n+1] = 0; }
+    }
+    return(len);
+}
+
+/* LOCATE THE CURSOR ON THE TERMINAL SCREEN
+ *     Tracks where the terminal's cursor really is (curx/cury) and
+ *     sends whichever of no motion, relative motion, overwriting or an
+ *     absolute address costs the fewest bytes.
+ */
+static void LocateXY(Screen *s, int x, int y)   /* x: 1-80, y:1-24 */
+{
+    const ScreenBackend *be = s->be;
+    char abs[MOVEMAX], rel[MOVEMAX*2];
+    int n = ABS(y - s->cury), len = -1, abslen;
+
+    if (x < 1) x = 1;
+    if (x == s->curx && y == s->cury) return;   /* already there */
+    abslen = be->xy(abs, x, y);
+
+    /* RELATIVE MOTION */
+    if (s->curx > 0 && s->cury > 0) {
+        if (y == s->cury)     { rel[0] = 0; len = 0; }
+        else if (y < s->cury) len = be->up(rel, n);
+        else                  len = be->down(rel, n);
+        if (len >= 0 && (n = HorizMove(s, rel+len, s->curx, x, y)) >= 0
+                     && len+n < abslen)
+            { Put(s, rel, len+n); abslen = -1; }
+    }
+    if (abslen >= 0) Put(s, abs, abslen);
+    s->curx = x;
+    s->cury = y;
+}
+
+/* DRAW A PIXEL ON THE TERMINAL AT CURRENT CURSOR POSITION
+ *     on: 1=pixel is on, 0=pixel is off
+ */
+static void DrawPixel(Screen *s, int on)
+{
+    Put(s, s->be->pixel[on], s->be->pixlen[on]);
+    if (s->curx > 0) s->curx += 2;
+}
+
+/* DRAW THE SHAPE THAT IS BEING "PREVIEWED" IN THE RIGHT HAND BOX */
+static void DrawPreview(Screen *s, int shape)
+{
+    int x,y;
+    for (y=0; y<SHAPEMAX; y++) {
+        LocateXY(s, PREVIEWXOFFSET,y+PREVIEWYOFFSET+1);
+        for (x=0; x<SHAPEMAX; x++)
+            DrawPixel(s, (TetrisMasks[shape][0][y]>>x) & 1 );
+    }
+    s->lastnext = shape;
+}
+
+/* UPDATE SCORE IF CHANGED (or forced to update) */
+static void UpdateScore(Screen *s, int rows, int force)
+{
+    char str[20];
+    if (force || rows!=s->lastrows) {
+        LocateXY(s, 54,22);
+        sprintf(str, "%d ", rows);
+        ScreenPuts(s, str);
+        s->curx += (int)strlen(str);
+        s->lastrows = rows;
+    }
+}
+
+/* UNPACK THE FRAME'S ROWS INTO back[] */
+static void UnpackRows(Screen *s, const Frame *f)
+{
+    int x,y;
+    for (y=0; y<GAMEHEIGHT; y++) {
+        if (!(f->dirty & (1UL<<y))) continue;
+        for (x=0; x<GAMEWIDTH; x++)
+            s->back[y][x] = (f->rows[y] >> (x+FIELDSHIFT)) & 1;
+    }
+}
+
+/* DRAW THE DIRTY ROWS' CHANGES
+ *     Compares back[] against front[] for the rows in 'dirty' only,
+ *     and draws just the pixels that differ.
+ */
+static void DrawRows(Screen *s, unsigned long dirty)
+{
+    int x,y;
+
+    for (y=0; y<GAMEHEIGHT; y++) {
+        if (!(dirty & (1UL<<y))) continue;
+        for (x=0; x<GAMEWIDTH; x++) {
+            if (s->back[y][x] == s->front[y][x]) continue;
+            LocateXY(s, x*2+LEFTOFFSET,y+TOPOFFSET);
+            DrawPixel(s, s->back[y][x]);
+            s->front[y][x] = s->back[y][x];
+        }
+    }
+}
+
+/* DRAW A FRAME ON THE TERMINAL
+ * f->all bit flags:
+ *     0       -- draws the frame's dirty rows + score/preview if changed
+ *     WINDOW  -- clear screen, redraw game's window outline, pieces, score+preview.
+ *     GSCREEN -- redraw all the pieces, score+preview.
+ */
+void ScreenDraw(Screen *s, const Frame *f)
+{
+    int x,y;
+
+    /* REDRAW WINDOW
+     *    Outline for game + preview + "Rows ="
+     */
+    if (f->all & WINDOW) {
+        ScreenClear(s);
+        for (y=0; G_window[y]; y++)
+            ScreenPrintf(s, "%s\r\n",G_window[y]);
+        s->curx = s->cury = -1;                         /* (tabs; don't track) */
+        memset(s->front, PIXOFF, sizeof(s->front));     /* screen's now blank */
+    } else if (f->all & GSCREEN) {
+        memset(s->front, PIXUNKNOWN, sizeof(s->front));
+    }
+
+    /* DRAW CHANGES TO THE SCREEN BUFFER */
+    UnpackRows(s, f);
+    DrawRows(s, f->dirty);
+
+    /* DRAW TEST SCREEN (DEBUGGING) */
+    if (f->test) {
+        for (y=0; y<GAMEHEIGHT; y++) {
+            LocateXY(s, 0,y+TOPOFFSET);
+            for (x=0; x<GAMEWIDTH; x++)
+                ScreenPrintf(s, "%d",s->back[y][x]);
+            if (s->curx > 0) s->curx += GAMEWIDTH;
+        }
+        LocateXY(s, 1,TOPOFFSET+GAMEHEIGHT+1);  /* last frame's output cost */
+        ScreenPrintf(s, "frame %ld bytes %ld writes   ", s->framebytes, s->framewrites);
+        s->curx = s->cury = -1;
+    }
+
+    UpdateScore(s, f->score, f->all);
+    if (f->all || f->nextshape != s->lastnext) DrawPreview(s, f->nextshape);
+    LocateXY(s, 1,1);
+    ScreenFlush(s);
+}
+
+/* DECODE ONE KEYSTROKE
+ *     Returns a function number, or 0 (not a key, or the middle of an
+ *     arrow key's escape sequence).
+ */
+int ScreenKey(Screen *s, int c)
+{
+    /* Handle arrow keys -- these are 3 character sequences:
+     *    up=ESC[A, down=ESC[B, right=ESC[C, left=ESC[D
+     */
+    switch ( s->esc ) {
+        case 0: if ( c == 0x1b ) { s->esc = 1; return 0; }
+                break;     /* fall thru to normal char handling */
+        case 1: if ( c == '[' ) { s->esc = 2; return 0; }
+                s->esc = 0;   /* reset */
+                break;     /* fall thru to normal char handling */
+        case 2: {
+            int ret = 0;
+            switch (c) {
+                case 'A': ret = ROTATE; break;  /*    UP KEY */
+                case 'B': ret = DOWN;   break;  /*  DOWN KEY */
+                case 'C': ret = RIGHT;  break;  /* RIGHT KEY */
+                case 'D': ret = LEFT;   break;  /*  LEFT KEY */
+            }
+            s->esc = 0;     /* last char in sequence, reset */
+            return ret;
+       }
+    }
+
+    s->esc = 0;
+    switch(c) {
+        case  'q': return(QUIT);
+        case  'j': return(DOWN);
+        case  'h': return(LEFT);
+        case  'l': return(RIGHT);
+        case  'p': return(PAUSE);
+        case  'z': return(TEST);
+        case  ' ': return(ROTATE);
+        case  'r': return(REDRAW);
+    }
+    return(0);
+}
+
+/* BUILD A FRAME FROM THE GAME
+ *     The rows the engine marked dirty (all of them, if 'all' is set)
+ *     as they should look: the petrified boxes + the moving shape.
+ *     Clears the game's dirty rows.
+ */
+void FrameCompose(Frame *f, TetrisGame *g, int all)
+{
+    const Row *mask = TetrisMasks[g->shape][g->rotate % 4];
+    int y,t;
+
+    if (all) g->dirty = ALLROWS;
+    f->all       = all;
+    f->dirty     = g->dirty;
+    f->score     = g->rows;
+    f->nextshape = g->nextshape;
+    f->test      = 0;
+    f->keyns     = 0;
+    for (y=0; y<GAMEHEIGHT; y++) {
+        if (!(f->dirty & (1UL<<y))) continue;
+        f->rows[y] = g->board[y];
+        t = y - g->y;
+        if (t >= 0 && t < SHAPEMAX)
+            f->rows[y] |= (mask[t] << (g->x+FIELDSHIFT)) & FULLROW;
+    }
+    g->dirty = 0;
+}
+
+/* BUILD A ROW FLASH FRAME: THE ROWS THE LAST STEP DELETED, ALL ON OR OFF */
+void FrameFlash(Frame *f, const TetrisGame *g, int on)
+{
+    int r;
+
+    f->all       = 0;
+    f->dirty     = 0;
+    f->score     = g->rows;
+    f->nextshape = g->nextshape;
+    f->test      = 0;
+    f->keyns     = 0;
+    for (r=0; r<g->ncleared; r++) {
+        f->rows[g->cleared[r]] = on ? FULLROW : 0;
+        f->dirty |= 1UL << g->cleared[r];
+    }
+}
+
+/* MERGE FRAME 'src' INTO THE OLDER FRAME 'dst' */
+void FrameMerge(Frame *dst, const Frame *src)
+{
+    int y;
+    for (y=0; y<GAMEHEIGHT; y++)
+        if (src->dirty & (1UL<<y)) dst->rows[y] = src->rows[y];
+    dst->all      |= src->all;
+    dst->dirty    |= src->dirty;
+    dst->score     = src->score;
+    dst->nextshape = src->nextshape;
+    dst->test      = src->test;
+    if (!dst->keyns) dst->keyns = src->keyns;
+}
+
+/* VIRTUAL TERMINAL
+ *     Decodes what the VT100 backend sends (and the window's tabs and
+ *     newlines) into a grid, as a VT100 would show it. Anything else
+ *     is ignored. Lines written past the bottom scroll the screen up.
+ */
+
+/* START BLANK, CURSOR HOME */
+void VTermInit(VTerm *vt)
+{
+    memset(vt, 0, sizeof(*vt));
+    memset(vt->text, ' ', sizeof(vt->text));
+}
+
+/* SCROLL UP A LINE */
+static void VTermScroll(VTerm *vt)
+{
+    memmove(vt->text[0], vt->text[1], (VTROWS-1)*VTCOLS);
+    memmove(vt->inverse[0], vt->inverse[1], (VTROWS-1)*VTCOLS);
+    memset(vt->text[VTROWS-1], ' ', VTCOLS);
+    memset(vt->inverse[VTROWS-1], 0, VTCOLS);
+    vt->y = VTROWS-1;
+}
+
+/* AN ESCAPE SEQUENCE'S LAST CHARACTER: DO IT */
+static void VTermCSI(VTerm *vt, int c)
+{
+    int n = (vt->param[0] > 0) ? vt->param[0] : 1;
+    switch (c) {
+        case 'H': vt->y = n-1;
+                  vt->x = ((vt->nparam > 1 && vt->param[1] > 0) ? vt->param[1] : 1) - 1; break;
+        case 'A': vt->y -= n; break;
+        case 'B': vt->y += n; break;
+        case 'C': vt->x += n; break;
+        case 'D': vt->x -= n; break;
+        case 'J': if (vt->param[0] == 2) {
+                      memset(vt->text, ' ', sizeof(vt->text));
+                      memset(vt->inverse, 0, sizeof(vt->inverse));
+                  }
+                  break;
+        case 'm': vt->attr = (vt->param[0] == 7); break;
+    }
+    if (vt->x < 0) vt->x = 0;
+    if (vt->x > VTCOLS-1) vt->x = VTCOLS-1;
+    if (vt->y < 0) vt->y = 0;
+    if (vt->y > VTROWS-1) vt->y = VTROWS-1;
+}
+
+/* TAKE OUTPUT (ScreenWriter) */
+int VTermWrite(void *arg, const char *buf, int len)
+{
+    VTerm *vt = (VTerm*)arg;
+    int t, c;
+
+    vt->bytes += len;
+    for (t=0; t<len; t++) {
+        c = (unsigned char)buf[t];
+        if (c == 030 || c == 032) { vt->esc = 0; continue; }   /* CAN, SUB */
+        if (vt->esc == 1) {                     /* ESC.. */
+            vt->esc = 0;
+            if (c == '[') {
+                vt->esc    = 2;
+                vt->nparam = 1;
+                memset(vt->param, 0, sizeof(vt->param));
+            }
+            continue;
+        }
+        if (vt->esc == 2) {                     /* ESC [.. */
+            if (c >= '0' && c <= '9') {
+                if (vt->nparam <= 4)
+                    vt->param[vt->nparam-1] = vt->param[vt->nparam-1] * 10 + c - '0';
+            } else if (c == ';') {
+                vt->nparam++;
+            } else {
+                vt->esc = 0;
+                VTermCSI(vt, c);
+            }
+            continue;
+        }
+        switch (c) {
+            case 033:  vt->esc = 1;                             break;
+            case '\r': vt->x = 0;                               break;
+            case '\n': if (++vt->y == VTROWS) VTermScroll(vt);  break;
+            case '\b': if (vt->x > 0) vt->x--;                  break;
+            case '\t': vt->x = (vt->x/8 + 1) * 8;
+                        if (vt->x > VTCOLS-1) vt->x = VTCOLS-1;
+                        break;
+            default:
+                if (c < ' ') break;
+                if (vt->x < VTCOLS) {
+                    vt->text[vt->y][vt->x]    = (char)c;
+                    vt->inverse[vt->y][vt->x] = (char)vt->attr;
+                    vt->x++;
+                }
+                break;
+        }
+    }
+    vt->writes++;
+    return(1);
+}
+
+/* READ THE PLAYFIELD BACK OFF A VIRTUAL TERMINAL
+ *     A cell's on if it shows a reverse video '#'.
+ */
+void VTermRows(const VTerm *vt, Row rows[GAMEHEIGHT])
+{
+    int x,y,cx,cy;
+    for (y=0; y<GAMEHEIGHT; y++) {
+        rows[y] = 0;
+        cy = y + TOPOFFSET - 1;
+        for (x=0; x<GAMEWIDTH; x++) {
+            cx = x*2 + LEFTOFFSET - 1;
+            if (vt->text[cy][cx] == '#' && vt->inverse[cy][cx])
+                rows[y] |= (Row)1 << (x+FIELDSHIFT);
+        }
+    }
+}
@@ -0,0 +1,115 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#ifndef SCREEN_H
+#define SCREEN_H
+#include "libtetris.h"
+
+/***********************************************************************
+ *
+ * SCREEN - Draws a game on one VT100/Wyse terminal, and decodes its keys
+ *
+ *     Everything that depends on the terminal lives in a Screen: its
+ *     backend (the escape sequences for its type, picked once from
+ *     $TERM), what it's showing, where its cursor is, the output being
+ *     built for it and the state of the key decoder. tetris.c has one
+ *     for its tty; tetris-server has one per connection.
+ *
+ *     The game side describes what the screen should look like as a
+ *     Frame (FrameCompose(), FrameFlash()); ScreenDraw() turns that
+ *     into the fewest bytes that get the terminal there. Output is
+ *     collected in the Screen's buffer and handed to its ScreenWriter
+ *     when full, and by ScreenFlush().
+ *
+ *     A VTerm is a headless terminal: a ScreenWriter that keeps the
+ *     24x80 grid a VT100 would show, so the real drawing code can be
+ *     run, timed and checked without a tty (see ScreenInitVirtual()).
+ *
+ ***********************************************************************/
+
+/* KEYSTROKE TRANSLATIONS (ScreenKey()) */
+#define DOWN   1
+#define LEFT   2
+#define RIGHT  3
+#define ROTATE 4
+#define QUIT   5
+#define PAUSE  6
+#define TEST   7
+#define REDRAW 8
+
+/* REDRAW MODES */
+#define CHANGED 0               /* redraw only whats changed */
+#define WINDOW  1               /* redraw only outer window (and score/preview) */
+#define GSCREEN 2               /* redraw only playing screen */
+#define ALL     WINDOW|GSCREEN  /* complete redraw */
+
+/* FRONT/BACK BUFFER PIXELS */
+#define PIXOFF          0       /* blank */
+#define PIXON           1       /* shape or petrified box */
+#define PIXUNKNOWN      2       /* not known to be either; always redrawn */
+
+/* WHAT THE SCREEN SHOULD LOOK LIKE */
+typedef struct {
+    int  all;                   /* redraw mode: WINDOW and/or GSCREEN */
+    unsigned long dirty;        /* rows[] that are set */
+    Row  rows[GAMEHEIGHT];      /* playfield rows, as they should look */
+    int  score, nextshape, test;
+    long long keyns;            /* HistNow() of the oldest key it shows (0: none) */
+} Frame;
+
+/* SENDS OUTPUT TO THE TERMINAL
+ *     Returns the write() calls it took (for the test screen's stats).
+ */
+typedef int ScreenWriter(void *arg, const char *buf, int len);
+
+/* A TERMINAL TYPE'S ESCAPE SEQUENCES (screen.c) */
+typedef struct ScreenBackend ScreenBackend;
+
+/* ONE TERMINAL */
+typedef struct {
+    const char *term;                   /* terminal type ($TERM); NULL: vt100 */
+    const ScreenBackend *be;            /* (its backend) */
+    char front[GAMEHEIGHT][GAMEWIDTH],  /* what the terminal is showing */
+         back[GAMEHEIGHT][GAMEWIDTH];   /* what it should show */
+    int  curx, cury;                    /* terminal's real cursor position (-1: unknown) */
+    int  lastrows, lastnext;            /* (last displayed score and preview) */
+    char *out;                          /* output being built.. */
+    int  outlen, outmax;                /* ..its length, and room for */
+    ScreenWriter *writer;               /* where output goes */
+    void *arg;                          /* (the writer's) */
+    long framebytes, framewrites,       /* output cost of the last frame */
+         frames, totalbytes, totalwrites;
+    int  esc;                           /* key decoder: escape sequence state */
+} Screen;
+
+/* A HEADLESS VT100 */
+#define VTROWS          24
+#define VTCOLS          80
+
+typedef struct {
+    char text[VTROWS][VTCOLS];          /* what it shows.. */
+    char inverse[VTROWS][VTCOLS];       /* ..and where it's in reverse video */
+    int  x, y, attr;                    /* cursor (0 based), reverse video on? */
+    int  esc, nparam, param[4];         /* escape sequence being decoded */
+    long bytes, writes;                 /* output it's been given */
+} VTerm;
+
+void ScreenInit(Screen *s, const char *term, char *out, int outmax,
+                ScreenWriter *writer, void *arg);
+void ScreenInitVirtual(Screen *s, VTerm *vt, char *out, int outmax);
+void ScreenTerm(Screen *s, const char *term);
+void ScreenPuts(Screen *s, const char *str);
+void ScreenPrintf(Screen *s, const char *fmt, ...);
+void ScreenFlush(Screen *s);
+void ScreenClear(Screen *s);
+void ScreenDraw(Screen *s, const Frame *f);
+int  ScreenKey(Screen *s, int c);
+
+void FrameCompose(Frame *f, TetrisGame *g, int all);
+void FrameFlash(Frame *f, const TetrisGame *g, int on);
+void FrameMerge(Frame *dst, const Frame *src);
+
+void VTermInit(VTerm *vt);
+int  VTermWrite(void *arg, const char *buf, int len);
+void VTermRows(const VTerm *vt, Row rows[GAMEHEIGHT]);
+
+#endif /*SCREEN_H*/
@@ -0,0 +1,1081 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#define _GNU_SOURCE                     /* accept4() */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "libtetris.h"
+#include "screen.h"
+
+/***********************************************************************
+ *
+ * TETRIS-SERVER - Many games over telnet, on a few threads (linux)
+ *
+ *     Each connection is a session with its own game and Screen (its
+ *     terminal type, what it's showing, its key decoder). Sessions are
+ *     spread over a few worker threads, each running an epoll loop over
+ *     its own sessions; all of a worker's sessions share one gravity
+ *     timer. Nothing blocks: sockets are non-blocking, output that the
+ *     socket won't take is queued, and a session whose queue would
+ *     pass OUTMAX has it thrown away and gets a full redraw once the
+ *     socket drains. So a session is a fixed size, however slow its
+ *     client.
+ *
+ *         tetris-server [--tcp port] [--unix path] [--watch port]
+ *                       [--threads n] [--gravity msec]
+ *
+ *     TCP connections (on 127.0.0.1) are telnet: the client is asked for
+ *     character mode and its terminal type. On the unix socket the
+ *     client is expected to send raw keys, eg:
+ *
+ *         telnet localhost 2323
+ *         socat -,raw,echo=0 unix-connect:path
+ *
+ *     The --watch port (also 127.0.0.1, telnet) shows the featured game
+ *     to any number of spectators; see SPECTATORS below.
+ *
+ ***********************************************************************/
+
+#define FRAMESIZE       4096    /* Screen output buffer (a full redraw fits) */
+#define OUTMAX          8192    /* output queued for a slow client, at most */
+#define MAXEVENTS       64      /* epoll events per wakeup */
+#define SPECQUEUE       64      /* frames queued for a slow spectator, at most */
+#define FLASHSTEPS      2       /* row flash: off-on.. */
+#define FLASHMSEC       300     /* ..approx 1/3 sec per step */
+
+/* TELNET (RFC 854, 1091) */
+#define IAC             255
+#define DONT            254
+#define DO              253
+#define WONT            252
+#define WILL            251
+#define SB              250
+#define SE              240
+#define IP              244     /* interrupt process (^C) */
+#define OPT_ECHO        1
+#define OPT_SGA         3       /* suppress go ahead */
+#define OPT_TTYPE       24      /* terminal type */
+#define TTYPE_IS        0
+#define TTYPE_SEND      1
+
+/* TELNET PARSER STATES */
+#define TDATA           0
+#define TIAC            1       /* after IAC */
+#define TOPT            2       /* after IAC WILL/WONT/DO/DONT */
+#define TSB             3       /* in a subnegotiation */
+#define TSBIAC          4       /* IAC in a subnegotiation */
+
+/* WHAT AN epoll EVENT IS FOR (the first member of Session, Spectator) */
+#define PLAYER          1
+#define SPECTATOR       2
+
+typedef struct Worker Worker;
+
+/* ONE CONNECTION */
+typedef struct Session {
+    int kind;                           /* PLAYER */
+    int fd;                             /* -1: closed, waiting to be freed */
+    Worker *w;
+    struct Broadcast *bc;               /* its spectators, if it's being watched */
+    struct Session *prev, *next,        /* worker's sessions */
+                   *fprev, *fnext;      /* worker's flashing sessions */
+    TetrisGame  game;
+    TetrisInput queue;                  /* keys not yet given to the engine */
+    Screen screen;
+    int  flash;                         /* next row flash step (0: not flashing) */
+    long flashdue;                      /* NowMsec() when that step is due */
+    int  paused, test,
+         ending,                        /* game over: close once output's sent */
+         behind,                        /* output thrown away: redraw when drained */
+         wantout;                       /* EPOLLOUT on? */
+    int  tstate, tcmd;                  /* telnet parser */
+    char term[32];                      /* telnet terminal type */
+    char sb[40];                        /* subnegotiation being read.. */
+    int  sblen;                         /* ..and its length */
+    char frame[FRAMESIZE];              /* (the Screen's output buffer) */
+    char out[OUTMAX];                   /* output the socket hasn't taken.. */
+    int  outhead, outlen;               /* ..where it starts, how much */
+} Session;
+
+/* ONE THREAD'S EPOLL LOOP */
+struct Worker {
+    pthread_t tid;
+    int ep, timer,                      /* epoll, gravity timerfd */
+        wake,                           /* eventfd: spectators handed over */
+        spare;                          /* /dev/null, closed to turn one away when out of fds */
+    Session *sessions, *flashing, *dead;
+    struct Spectator *deadspectators;
+    long nsessions;
+    pthread_mutex_t lock;               /* (for handoff[]) */
+    int *handoff, nhandoff, maxhandoff; /* spectator sockets from other workers */
+};
+
+int Glisten[3] = { -1, -1, -1 };        /* TCP, unix, --watch listening sockets */
+Session *Gfeatured = NULL;              /* the game spectators see */
+pthread_mutex_t Gfeaturelock = PTHREAD_MUTEX_INITIALIZER;
+long Ggravity = 1000;                   /* --gravity */
+unsigned long Gcount = 0;               /* sessions started (for seeds) */
+pthread_mutex_t Gcountlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* MONOTONIC CLOCK IN MILLISECONDS */
+long NowMsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((long)ts.tv_sec*1000L + ts.tv_nsec/1000000L);
+}
+
+/* WATCH FOR OUTPUT ROOM, OR STOP */
+static void WantOutput(Session *s, int on)
+{
+    struct epoll_event ev;
+    if (s->wantout == on) return;
+    ev.events   = EPOLLIN | EPOLLRDHUP | (on ? EPOLLOUT : 0);
+    ev.data.ptr = s;
+    epoll_ctl(s->w->ep, EPOLL_CTL_MOD, s->fd, &ev);
+    s->wantout = on;
+}
+
+/* SEND OUTPUT TO A SESSION'S SOCKET (ScreenWriter)
+ *     Never waits: what the socket won't take is queued; if the queue
+ *     would overflow, the output is thrown away and the session is
+ *     'behind' until the socket drains.
+ */
+static int SessionWrite(void *arg, const char *buf, int len)
+{
+    Session *s = (Session*)arg;
+    int n;
+
+    if (s->fd < 0 || s->behind) return(0);
+    if (s->outlen == 0) {                       /* nothing queued: try the socket */
+        if ((n = (int)send(s->fd, buf, len, MSG_NOSIGNAL|MSG_DONTWAIT)) < 0)
+            n = 0;                              /* (errors show up as EPOLLERR) */
+        buf += n;
+        len -= n;
+        if (len == 0) return(1);
+    }
+    if (s->outlen + len > OUTMAX) {             /* too slow: throw it away */
+        s->behind = 1;
+        s->outlen = 0;
+    } else {
+        if (s->outhead + s->outlen + len > OUTMAX) {
+            memmove(s->out, s->out + s->outhead, s->outlen);
+            s->outhead = 0;
+        }
+        memcpy(s->out + s->outhead + s->outlen, buf, len);
+        s->outlen += len;
+    }
+    WantOutput(s, 1);
+    return(1);
+}
+
+/* STOP OR START THE SESSION'S ROW FLASH */
+static void SetFlash(Session *s, int flash)
+{
+    Worker *w = s->w;
+    if (!s->flash == !flash) { s->flash = flash; return; }
+    if (flash) {                                /* onto the flashing list */
+        s->fprev = NULL;
+        s->fnext = w->flashing;
+        if (w->flashing) w->flashing->fprev = s;
+        w->flashing = s;
+    } else {
+        if (s->fprev) s->fprev->fnext = s->fnext;
+        else          w->flashing     = s->fnext;
+        if (s->fnext) s->fnext->fprev = s->fprev;
+    }
+    s->flash = flash;
+}
+
+/* SPECTATORS
+ *     The featured game (Gfeatured: the first started; when it ends,
+ *     another on its worker, or the next to start) can be watched on
+ *     the --watch port. Its frames are drawn once more,
+ *     into the Broadcast's own Screen: a VT100 that every spectator
+ *     who's in sync is a copy of. That output becomes a Chunk, and
+ *     every spectator's queue gets a reference to it. Each spectator's
+ *     queue then goes out with one writev(). Nothing is drawn per
+ *     spectator, so a frame costs the same however many are watching.
+ *
+ *     A spectator joining late is sent a snapshot: a full redraw of
+ *     what the Broadcast's Screen shows. It's made once per frame,
+ *     however many join. A spectator whose queue fills is dropped
+ *     from the stream and sent a fresh snapshot once its socket drains.
+ *
+ *     All spectators of a game are on its worker's thread (see
+ *     Handoff()), so the reference counts need no locking.
+ */
+typedef struct {
+    int  refs, len;
+    char data[];
+} Chunk;
+
+typedef struct Spectator {
+    int kind;                           /* SPECTATOR */
+    int fd;                             /* -1: closed, waiting to be freed */
+    Worker *w;
+    struct Broadcast *bc;
+    struct Spectator *prev, *next;      /* the broadcast's spectators */
+    Chunk *queue[SPECQUEUE];            /* output not sent yet.. */
+    int  head, n, off;                  /* ..first, how many, bytes of the first sent */
+    int  behind,                        /* dropped: send a snapshot when drained */
+         ending,                        /* game over: close once output's sent */
+         wantout;                       /* EPOLLOUT on? */
+} Spectator;
+
+typedef struct Broadcast {
+    Session *session;                   /* the game (NULL: it's over) */
+    Screen screen;                      /* what spectators in sync are showing */
+    char frame[FRAMESIZE];              /* (its output buffer) */
+    Spectator *spectators;
+    long nspectators;
+    Chunk *snap;                        /* snapshot for late joiners.. */
+    long snapframe;                     /* ..made at this screen.frames */
+    Chunk *end;                         /* game over message */
+    int drawing;                        /* in the middle of a frame */
+} Broadcast;
+
+static int SpectatorWrite(Spectator *p);
+
+/* A NEW CHUNK (one reference, the caller's) */
+static Chunk *NewChunk(const char *buf, int len)
+{
+    Chunk *c;
+    if (!(c = malloc(sizeof(Chunk) + len))) return(NULL);
+    c->refs = 1;
+    c->len  = len;
+    memcpy(c->data, buf, len);
+    return(c);
+}
+
+static void Unref(Chunk *c)
+{
+    if (--c->refs == 0) free(c);
+}
+
+/* WATCH FOR OUTPUT ROOM, OR STOP */
+static void SpectatorWantOutput(Spectator *p, int on)
+{
+    struct epoll_event ev;
+    if (p->wantout == on) return;
+    ev.events   = EPOLLIN | EPOLLRDHUP | (on ? EPOLLOUT : 0);
+    ev.data.ptr = p;
+    epoll_ctl(p->w->ep, EPOLL_CTL_MOD, p->fd, &ev);
+    p->wantout = on;
+}
+
+/* THROW AWAY A SPECTATOR'S QUEUE, BUT FOR THE FIRST keep CHUNKS */
+static void Drop(Spectator *p, int keep)
+{
+    while (p->n > keep) {
+        p->n--;
+        Unref(p->queue[(p->head + p->n) % SPECQUEUE]);
+    }
+    if (p->n == 0) p->head = p->off = 0;
+}
+
+/* ADD A CHUNK TO A SPECTATOR'S QUEUE
+ *     One that's too far behind is dropped from the stream instead.
+ */
+static void Enqueue(Spectator *p, Chunk *c)
+{
+    if (p->fd < 0 || p->behind) return;
+    if (p->n == SPECQUEUE) {
+        Drop(p, p->off ? 1 : 0);       /* (finish the chunk it's partway through) */
+        p->behind = 1;
+        SpectatorWantOutput(p, 1);
+        return;
+    }
+    p->queue[(p->head + p->n) % SPECQUEUE] = c;
+    c->refs++;
+    p->n++;
+}
+
+/* FREE THE BROADCAST ONCE ITS GAME AND SPECTATORS ARE ALL GONE */
+static void FreeBroadcast(Broadcast *bc)
+{
+    if (bc->session || bc->spectators) return;
+    if (bc->snap) Unref(bc->snap);
+    if (bc->end)  Unref(bc->end);
+    free(bc);
+}
+
+/* HANG UP ON A SPECTATOR (freed after this batch of events) */
+static void SpectatorClose(Spectator *p)
+{
+    Broadcast *bc = p->bc;
+    Worker *w = p->w;
+
+    if (p->fd < 0) return;
+    Drop(p, 0);
+    epoll_ctl(w->ep, EPOLL_CTL_DEL, p->fd, NULL);
+    close(p->fd);
+    p->fd = -1;
+    if (p->prev) p->prev->next   = p->next;
+    else         bc->spectators  = p->next;
+    if (p->next) p->next->prev   = p->prev;
+    bc->nspectators--;
+    p->next = w->deadspectators;
+    w->deadspectators = p;
+    FreeBroadcast(bc);
+}
+
+/* SEND BROADCAST OUTPUT TO EVERY SPECTATOR (ScreenWriter) */
+static int BroadcastWrite(void *arg, const char *buf, int len)
+{
+    Broadcast *bc = (Broadcast*)arg;
+    Spectator *p, *next;
+    Chunk *c;
+
+    if (!bc->spectators || !(c = NewChunk(buf, len))) return(0);
+    for (p=bc->spectators; p; p=next) {
+        next = p->next;                 /* (p may close) */
+        Enqueue(p, c);
+        SpectatorWrite(p);
+    }
+    Unref(c);
+    return(1);
+}
+
+/* COLLECT A SNAPSHOT'S OUTPUT INTO ONE CHUNK (ScreenWriter) */
+static int SnapWrite(void *arg, const char *buf, int len)
+{
+    Chunk **cp = (Chunk**)arg, *c;
+    int old = *cp ? (*cp)->len : 0;
+
+    if (!(c = realloc(*cp, sizeof(Chunk) + old + len))) return(0);
+    c->refs = 1;
+    c->len  = old + len;
+    memcpy(c->data + old, buf, len);
+    *cp = c;
+    return(1);
+}
+
+/* A FULL REDRAW OF WHAT THE BROADCAST'S SCREEN IS SHOWING
+ *     Leaves a late joiner's terminal just like an in-sync spectator's,
+ *     so it can follow the stream from the next frame on.
+ */
+static Chunk *Snapshot(Broadcast *bc)
+{
+    char buf[FRAMESIZE];
+    Screen tmp = bc->screen;
+    Chunk *c = NULL;
+    Frame f;
+    int x,y;
+
+    if (bc->snap && bc->snapframe == bc->screen.frames) return(bc->snap);
+    f.all   = ALL;
+    f.dirty = ALLROWS;
+    for (y=0; y<GAMEHEIGHT; y++)
+        for (f.rows[y]=0, x=0; x<GAMEWIDTH; x++)
+            if (bc->screen.front[y][x] == PIXON) f.rows[y] |= (Row)1 << (x+FIELDSHIFT);
+    f.score     = bc->screen.lastrows;
+    f.nextshape = bc->screen.lastnext;
+    f.test      = 0;
+    f.keyns     = 0;
+    tmp.out    = buf;
+    tmp.outlen = 0;
+    tmp.writer = SnapWrite;
+    tmp.arg    = &c;
+    SnapWrite(&c, "\030", 1);          /* CAN: ends any escape sequence cut off */
+    ScreenDraw(&tmp, &f);
+    if (!c) return(NULL);
+    if (bc->snap) Unref(bc->snap);
+    bc->snap      = c;
+    bc->snapframe = bc->screen.frames;
+    return(c);
+}
+
+/* SEND A SPECTATOR'S QUEUE (one writev() per call)
+ *     Returns -1 if it hung up.
+ */
+static int SpectatorWrite(Spectator *p)
+{
+    struct iovec iov[SPECQUEUE];
+    Chunk *c;
+    int t, n;
+    ssize_t sent;
+
+    while (p->fd >= 0) {
+        if (p->n == 0) {
+            if (!p->behind) {
+                if (p->ending) break;
+                SpectatorWantOutput(p, 0);
+                return(0);
+            }
+            if (p->bc->drawing) { SpectatorWantOutput(p, 0); return(0); }
+            p->behind = 0;              /* caught up: start it over */
+            if ((c = Snapshot(p->bc))) Enqueue(p, c);
+            if (p->ending && p->bc->end) Enqueue(p, p->bc->end);
+            if (p->n == 0) break;
+            continue;
+        }
+        for (t=0, n=p->n; t<n; t++) {
+            c = p->queue[(p->head + t) % SPECQUEUE];
+            iov[t].iov_base = c->data + (t ? 0 : p->off);
+            iov[t].iov_len  = c->len  - (t ? 0 : p->off);
+        }
+        if ((sent = writev(p->fd, iov, n)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) break;
+            SpectatorWantOutput(p, 1);
+            return(0);
+        }
+        while (sent > 0) {              /* let go of what's gone */
+            c = p->queue[p->head];
+            if (sent < c->len - p->off) { p->off += (int)sent; break; }
+            sent -= c->len - p->off;
+            p->off  = 0;
+            p->head = (p->head + 1) % SPECQUEUE;
+            p->n--;
+            Unref(c);
+        }
+    }
+    SpectatorClose(p);
+    return(-1);
+}
+
+/* DRAW A FRAME FOR THE SPECTATORS */
+static void BroadcastFrame(Broadcast *bc, const Frame *f)
+{
+    Spectator *p, *next;
+    Frame b = *f;
+
+    b.test = 0;
+    bc->drawing = 1;
+    ScreenDraw(&bc->screen, &b);
+    bc->drawing = 0;
+    for (p=bc->spectators; p; p=next) { /* catch up any left behind mid-frame */
+        next = p->next;
+        if (p->behind && p->n == 0) SpectatorWrite(p);
+    }
+}
+
+/* THE GAME'S OVER: TELL THE SPECTATORS, AND LET THEM GO */
+static void BroadcastEnd(Broadcast *bc, const char *msg)
+{
+    Spectator *p, *next;
+    Session *s = bc->session;
+    char buf[128];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "\033[24H\r%s\r\nTotal rows: %d\r\n", msg, s->game.rows);
+    bc->end = NewChunk(buf, len);
+    s->bc = NULL;
+    for (p=bc->spectators; p; p=next) {
+        next = p->next;
+        p->ending = 1;
+        if (bc->end) Enqueue(p, bc->end);
+        SpectatorWrite(p);
+    }
+    bc->session = NULL;                 /* (last, so the loop can't free it) */
+    FreeBroadcast(bc);
+}
+
+/* CLOSE THE CONNECTION
+ *     The session is freed once the worker's done with this batch of
+ *     events (some may still be for it).
+ */
+static void Close(Session *s)
+{
+    Worker *w = s->w;
+    if (s->fd < 0) return;
+    if (s->bc) BroadcastEnd(s->bc, "Player left.");
+    SetFlash(s, 0);
+    epoll_ctl(w->ep, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    s->fd = -1;
+    if (s->prev) s->prev->next = s->next;
+    else         w->sessions   = s->next;
+    if (s->next) s->next->prev = s->prev;
+    pthread_mutex_lock(&Gfeaturelock);
+    if (Gfeatured == s) Gfeatured = w->sessions;    /* (or the next to start) */
+    pthread_mutex_unlock(&Gfeaturelock);
+    s->next = w->dead;
+    w->dead = s;
+    w->nsessions--;
+}
+
+/* DRAW A FRAME FOR THE PLAYER, AND ANY SPECTATORS */
+static void Draw(Session *s, Frame *f)
+{
+    if (s->bc) BroadcastFrame(s->bc, f);
+    f->test = s->test;
+    ScreenDraw(&s->screen, f);
+}
+
+/* REDRAW THE SESSION'S SCREEN (see Redraw() in tetris.c) */
+static void Redraw(Session *s, int all)
+{
+    Frame f;
+    FrameCompose(&f, &s->game, all);
+    Draw(s, &f);
+}
+
+/* GAME OVER: SHOW WHY AND THE SCORE, THEN HANG UP */
+static void End(Session *s, const char *msg)
+{
+    Screen *scr = &s->screen;
+    ScreenPuts(scr, "\033[24H\r");
+    ScreenPrintf(scr, "%s\r\n", msg);
+    ScreenPrintf(scr, "Total rows: %d\r\n", s->game.rows);
+    ScreenPrintf(scr, "Seed: %llu\r\n", s->game.seed);
+    ScreenFlush(scr);
+    if (s->bc) BroadcastEnd(s->bc, msg);
+    s->ending = 1;
+    if (s->outlen == 0) Close(s);
+}
+
+/* ADVANCE THE ROW FLASH ANIMATION (see FlashCompletedRows() in tetris.c) */
+static void FlashStep(Session *s)
+{
+    Frame f;
+
+    if (s->flash > FLASHSTEPS) {        /* done: show the engine's screen */
+        SetFlash(s, 0);
+        Redraw(s, CHANGED);
+        return;
+    }
+    FrameFlash(&f, &s->game, !(s->flash&1));
+    Draw(s, &f);
+    s->flash++;
+    s->flashdue = NowMsec() + FLASHMSEC;
+}
+
+/* GIVE THE QUEUED KEYS (AND GRAVITY) TO THE ENGINE */
+static void Step(Session *s)
+{
+    TetrisInput in;
+    int ret;
+
+    if (s->flash || s->paused || s->ending) return;   /* keys wait 'til it's done */
+    if (!(s->queue.x || s->queue.y || s->queue.rotate || s->queue.yforce)) return;
+    in = s->queue;
+    memset(&s->queue, 0, sizeof(s->queue));
+    ret = TetrisStep(&s->game, &in);
+    if (ret & TETRIS_DIED) { End(s, "YOU DIED."); return; }
+    if (ret & TETRIS_ROWS) {            /* briefly flash completed rows on+off */
+        SetFlash(s, 1);
+        FlashStep(s);
+    } else {
+        Redraw(s, CHANGED);
+    }
+}
+
+/* SEND TELNET BYTES */
+static void TelnetSend(Session *s, int a, int b, int c)
+{
+    char buf[3];
+    buf[0] = (char)a; buf[1] = (char)b; buf[2] = (char)c;
+    SessionWrite(s, buf, 3);
+}
+
+/* A TELNET SUBNEGOTIATION ENDED: TERMINAL TYPE? */
+static void TelnetSub(Session *s)
+{
+    int t;
+    if (s->sblen < 2 || (unsigned char)s->sb[0] != OPT_TTYPE || s->sb[1] != TTYPE_IS)
+        return;
+    for (t=0; t<s->sblen-2 && t<(int)sizeof(s->term)-1; t++)
+        s->term[t] = (char)tolower((unsigned char)s->sb[t+2]);
+    s->term[t] = 0;
+    ScreenTerm(&s->screen, s->term);
+    Redraw(s, ALL);                     /* (drawn for the wrong terminal so far) */
+}
+
+/* STRIP TELNET COMMANDS FROM THE INPUT
+ *     Returns the byte if it's data, or -1.
+ */
+static int Telnet(Session *s, int c)
+{
+    switch (s->tstate) {
+        case TDATA:
+            if (c == IAC) { s->tstate = TIAC; return(-1); }
+            return(c);
+        case TIAC:
+            s->tstate = TDATA;
+            switch (c) {
+                case IAC:  return(c);                   /* escaped 255 */
+                case IP:   return(3);                   /* as ^C */
+                case WILL: case WONT: case DO: case DONT:
+                           s->tcmd = c; s->tstate = TOPT; break;
+                case SB:   s->sblen = 0; s->tstate = TSB; break;
+            }
+            return(-1);
+        case TOPT:
+            s->tstate = TDATA;
+            if (s->tcmd == WILL && c == OPT_TTYPE) {    /* ask for it */
+                TelnetSend(s, IAC, SB, OPT_TTYPE);
+                TelnetSend(s, TTYPE_SEND, IAC, SE);
+            }
+            return(-1);
+        case TSB:
+            if (c == IAC) s->tstate = TSBIAC;
+            else if (s->sblen < (int)sizeof(s->sb)) s->sb[s->sblen++] = (char)c;
+            return(-1);
+        case TSBIAC:
+            if (c == SE) { s->tstate = TDATA; TelnetSub(s); }
+            else {
+                s->tstate = TSB;
+                if (s->sblen < (int)sizeof(s->sb)) s->sb[s->sblen++] = (char)c;
+            }
+            return(-1);
+    }
+    return(-1);
+}
+
+/* HANDLE ONE KEYSTROKE (see HandleButtons() in tetris.c) */
+static void Key(Session *s, int c)
+{
+    if (c == 3) { End(s, "Quit"); return; }     /* ^C */
+    if (!(c = ScreenKey(&s->screen, c))) return;
+    if (s->paused) { s->paused = 0; return; }   /* any key continues */
+    switch (c) {
+        case   LEFT: s->queue.x      -= 1; break;
+        case  RIGHT: s->queue.x      += 1; break;
+        case   DOWN: s->queue.y      += 1; break;
+        case ROTATE: s->queue.rotate += 1; break;
+        case   QUIT: End(s, "Quit");       break;
+        case  PAUSE: s->paused = 1;        break;
+        case   TEST: s->test ^= 1;         break;
+        case REDRAW: SetFlash(s, 0);       /* (cuts any flash short) */
+                     Redraw(s, ALL);       break;
+    }
+}
+
+/* READ WHAT THE CLIENT SENT */
+static void Input(Session *s)
+{
+    unsigned char buf[256];
+    int n, t, c;
+
+    while ((n = (int)recv(s->fd, buf, sizeof(buf), 0)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) Close(s);
+            return;
+        }
+        for (t=0; t<n && s->fd >= 0 && !s->ending; t++)
+            if ((c = Telnet(s, buf[t])) >= 0) Key(s, c);
+        if (s->fd < 0 || s->ending) return;
+        Step(s);
+    }
+    Close(s);                           /* hung up */
+}
+
+/* THE SOCKET HAS ROOM: SEND WHAT'S QUEUED */
+static void Output(Session *s)
+{
+    int n;
+
+    while (s->outlen) {
+        n = (int)send(s->fd, s->out + s->outhead, s->outlen, MSG_NOSIGNAL|MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) Close(s);
+            return;
+        }
+        s->outhead += n;
+        s->outlen  -= n;
+    }
+    s->outhead = 0;
+    if (s->ending) { Close(s); return; }
+    WantOutput(s, 0);
+    if (s->behind) {                    /* caught up: start the screen over */
+        s->behind = 0;
+        Redraw(s, ALL);
+    }
+}
+
+/* START A SESSION ON A NEW CONNECTION */
+static void Start(Worker *w, int fd, int telnet)
+{
+    struct epoll_event ev;
+    Session *s;
+    unsigned long n;
+    int one = 1;
+
+    if (!(s = calloc(1, sizeof(Session)))) { close(fd); return; }
+    if (telnet) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    s->kind = PLAYER;
+    s->fd   = fd;
+    s->w    = w;
+    ev.events   = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = s;
+    if (epoll_ctl(w->ep, EPOLL_CTL_ADD, fd, &ev) < 0) { close(fd); free(s); return; }
+
+    s->next = w->sessions;
+    if (w->sessions) w->sessions->prev = s;
+    w->sessions = s;
+    w->nsessions++;
+
+    pthread_mutex_lock(&Gcountlock);
+    n = Gcount++;
+    pthread_mutex_unlock(&Gcountlock);
+    ScreenInit(&s->screen, NULL, s->frame, FRAMESIZE, SessionWrite, s);
+    TetrisInit(&s->game, (unsigned long long)time(NULL) << 20 ^ n);
+    if (telnet) {                       /* character mode, no echo; what terminal? */
+        TelnetSend(s, IAC, WILL, OPT_ECHO);
+        TelnetSend(s, IAC, WILL, OPT_SGA);
+        TelnetSend(s, IAC, DO,   OPT_SGA);
+        TelnetSend(s, IAC, DO,   OPT_TTYPE);
+    }
+    Redraw(s, ALL);
+
+    pthread_mutex_lock(&Gfeaturelock);
+    if (!Gfeatured) Gfeatured = s;
+    pthread_mutex_unlock(&Gfeaturelock);
+}
+
+/* START WATCHING THE FEATURED GAME (on its worker's thread) */
+static void Spectate(Worker *w, int fd)
+{
+    static const char telnet[] = { (char)IAC, (char)WILL, OPT_ECHO, (char)IAC, (char)WILL, OPT_SGA };
+    static const char none[] = "No game to watch.\r\n";
+    struct epoll_event ev;
+    Broadcast *bc;
+    Spectator *p;
+    TetrisGame g;
+    Session *s;
+    Chunk *c;
+    Frame f;
+
+    pthread_mutex_lock(&Gfeaturelock);
+    s = Gfeatured;                      /* (can't be freed while we hold the lock) */
+    if (s && (s->w != w || s->ending)) s = NULL;
+    pthread_mutex_unlock(&Gfeaturelock);  /* (it's ours: only this thread can end it) */
+    if (send(fd, telnet, sizeof(telnet), MSG_NOSIGNAL) < 0) { close(fd); return; }
+    if (!s || !(p = calloc(1, sizeof(Spectator)))) {
+        if (send(fd, none, sizeof(none)-1, MSG_NOSIGNAL) < 0) { }
+        close(fd);
+        return;
+    }
+    if (!(bc = s->bc)) {                /* first spectator: start broadcasting */
+        if (!(bc = calloc(1, sizeof(Broadcast)))) { close(fd); free(p); return; }
+        ScreenInit(&bc->screen, NULL, bc->frame, FRAMESIZE, BroadcastWrite, bc);
+        bc->session = s;
+        s->bc = bc;
+        g = s->game;                    /* (composing clears the game's dirty rows) */
+        FrameCompose(&f, &g, ALL);
+        BroadcastFrame(bc, &f);         /* (to no one yet; sets up bc->screen) */
+    }
+    p->kind = SPECTATOR;
+    p->fd   = fd;
+    p->w    = w;
+    p->bc   = bc;
+    ev.events   = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = p;
+    if (epoll_ctl(w->ep, EPOLL_CTL_ADD, fd, &ev) < 0) { close(fd); free(p); FreeBroadcast(bc); return; }
+    p->next = bc->spectators;
+    if (bc->spectators) bc->spectators->prev = p;
+    bc->spectators = p;
+    bc->nspectators++;
+    if ((c = Snapshot(bc))) Enqueue(p, c);
+    SpectatorWrite(p);
+}
+
+/* A SPECTATOR TYPED SOMETHING: ANY 'q' (OR ^C) HANGS UP */
+static void SpectatorInput(Spectator *p)
+{
+    char buf[256];
+    int n;
+
+    while ((n = (int)recv(p->fd, buf, sizeof(buf), 0)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) break;
+            return;
+        }
+        if (memchr(buf, 'q', n) || memchr(buf, 3, n)) break;
+    }
+    SpectatorClose(p);
+}
+
+/* PASS A SPECTATOR'S SOCKET TO THE FEATURED GAME'S WORKER */
+static void Watch(Worker *w, int fd)
+{
+    uint64_t one = 1;
+    Worker *to;
+
+    pthread_mutex_lock(&Gfeaturelock);
+    to = Gfeatured ? Gfeatured->w : w;
+    pthread_mutex_unlock(&Gfeaturelock);
+    if (to == w) { Spectate(w, fd); return; }
+
+    pthread_mutex_lock(&to->lock);
+    if (to->nhandoff == to->maxhandoff) {
+        int *h = realloc(to->handoff, (to->maxhandoff ? to->maxhandoff * 2 : 16) * sizeof(int));
+        if (!h) { pthread_mutex_unlock(&to->lock); close(fd); return; }
+        to->handoff     = h;
+        to->maxhandoff  = to->maxhandoff ? to->maxhandoff * 2 : 16;
+    }
+    to->handoff[to->nhandoff++] = fd;
+    pthread_mutex_unlock(&to->lock);
+    if (write(to->wake, &one, sizeof(one)) < 0) { }
+}
+
+/* TAKE THE SPECTATORS OTHER WORKERS PASSED US */
+static void Handoff(Worker *w)
+{
+    uint64_t n;
+    int t, nfds, fds[64];
+
+    if (read(w->wake, &n, sizeof(n)) < 0) { }
+    do {
+        pthread_mutex_lock(&w->lock);
+        for (nfds=0; nfds<64 && w->nhandoff; nfds++)
+            fds[nfds] = w->handoff[--w->nhandoff];
+        pthread_mutex_unlock(&w->lock);
+        for (t=0; t<nfds; t++) Spectate(w, fds[t]);
+    } while (nfds == 64);
+}
+
+/* ACCEPT EVERY CONNECTION WAITING
+ *     Out of fds, connections are accepted on the spare one and closed,
+ *     else they'd stay waiting and the listening socket would wake us
+ *     again straight away, forever.
+ */
+static void Accept(Worker *w, int lfd)
+{
+    int fd;
+    while (1) {
+        if ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0) {
+            if (lfd == Glisten[2]) Watch(w, fd);
+            else                   Start(w, fd, lfd == Glisten[0]);
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if ((errno != EMFILE && errno != ENFILE) || w->spare < 0) break;
+        close(w->spare);
+        if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) >= 0) close(fd);
+        w->spare = open("/dev/null", O_RDONLY|O_CLOEXEC);
+        if (fd < 0) break;
+    }
+}
+
+/* GRAVITY: EVERY SESSION'S SHAPE DROPS */
+static void Gravity(Worker *w)
+{
+    Session *s, *next;
+    uint64_t expired;
+
+    if (read(w->timer, &expired, sizeof(expired)) != sizeof(expired)) return;
+    for (s=w->sessions; s; s=next) {
+        next = s->next;                 /* (s may close) */
+        if (s->paused || s->ending) continue;
+        s->queue.yforce = 1;
+        Step(s);
+    }
+}
+
+/* ONE WORKER'S EVENT LOOP */
+static void *Work(void *arg)
+{
+    Worker *w = (Worker*)arg;
+    struct epoll_event ev[MAXEVENTS];
+    Session *s, *next;
+    Spectator *p, *pnext;
+    void *ptr;
+    long now, wait;
+    int n, t;
+
+    while (1) {
+        /* SLEEP 'TIL SOMETHING HAPPENS, OR THE NEXT ROW FLASH STEP IS DUE */
+        wait = -1;
+        now  = NowMsec();
+        for (s=w->flashing; s; s=s->fnext)
+            if (wait < 0 || s->flashdue - now < wait)
+                wait = (s->flashdue > now) ? s->flashdue - now : 0;
+        if ((n = epoll_wait(w->ep, ev, MAXEVENTS, (int)wait)) < 0) n = 0;    /* EINTR */
+
+        for (t=0; t<n; t++) {
+            ptr = ev[t].data.ptr;
+            if (ptr == &Glisten[0] || ptr == &Glisten[1] || ptr == &Glisten[2]) {
+                Accept(w, *(int*)ptr);
+            } else if (ptr == &w->timer) {
+                Gravity(w);
+            } else if (ptr == &w->wake) {
+                Handoff(w);
+            } else if (*(int*)ptr == PLAYER) {
+                s = (Session*)ptr;
+                if (s->fd >= 0 && (ev[t].events & EPOLLOUT)) Output(s);
+                if (s->fd >= 0 && (ev[t].events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)))
+                    Input(s);
+            } else {
+                p = (Spectator*)ptr;
+                if (p->fd >= 0 && (ev[t].events & EPOLLOUT)) SpectatorWrite(p);
+                if (p->fd >= 0 && (ev[t].events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)))
+                    SpectatorInput(p);
+            }
+        }
+
+        now = NowMsec();
+        for (s=w->flashing; s; s=next) {
+            next = s->fnext;
+            if (now < s->flashdue) continue;
+            FlashStep(s);
+            Step(s);                    /* (keys that waited for it) */
+        }
+
+        for (s=w->dead; s; s=next) {    /* closed during this batch */
+            next = s->next;
+            free(s);
+        }
+        w->dead = NULL;
+        for (p=w->deadspectators; p; p=pnext) {
+            pnext = p->next;
+            free(p);
+        }
+        w->deadspectators = NULL;
+    }
+    return(NULL);
+}
+
+/* START A WORKER THREAD */
+static void StartWorker(Worker *w)
+{
+    struct epoll_event ev;
+    struct itimerspec its;
+    int t;
+
+    if ((w->ep = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (w->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0 ||
+        (w->wake = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0 ||
+        (w->spare = open("/dev/null", O_RDONLY|O_CLOEXEC)) < 0) {
+        perror("tetris-server: epoll/timerfd/eventfd");
+        exit(1);
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    its.it_interval.tv_sec  = Ggravity / 1000;
+    its.it_interval.tv_nsec = (Ggravity % 1000) * 1000000L;
+    its.it_value            = its.it_interval;
+    timerfd_settime(w->timer, 0, &its, NULL);
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &w->timer;
+    epoll_ctl(w->ep, EPOLL_CTL_ADD, w->timer, &ev);
+    ev.data.ptr = &w->wake;
+    epoll_ctl(w->ep, EPOLL_CTL_ADD, w->wake, &ev);
+
+    for (t=0; t<3; t++) {               /* one worker takes each connection */
+        if (Glisten[t] < 0) continue;
+        ev.events   = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = &Glisten[t];
+        epoll_ctl(w->ep, EPOLL_CTL_ADD, Glisten[t], &ev);
+    }
+    if (pthread_create(&w->tid, NULL, Work, w) != 0) {
+        perror("tetris-server: pthread_create");
+        exit(1);
+    }
+}
+
+/* LISTEN ON 127.0.0.1:port */
+static int ListenTCP(int port)
+{
+    struct sockaddr_in sin;
+    int fd, one = 1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family      = AF_INET;
+    sin.sin_port        = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((fd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        bind(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        perror("tetris-server: tcp");
+        exit(1);
+    }
+    return(fd);
+}
+
+/* LISTEN ON A UNIX SOCKET (replacing any old one) */
+static int ListenUnix(const char *path)
+{
+    struct sockaddr_un sun;
+    int fd;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "tetris-server: %s: path too long\n", path);
+        exit(1);
+    }
+    strcpy(sun.sun_path, path);
+    unlink(path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0 ||
+        bind(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        perror(path);
+        exit(1);
+    }
+    return(fd);
+}
+
+void Usage(void)
+{
+    fprintf(stderr, "usage: tetris-server [--tcp port] [--unix path] [--watch port]\n"
+                    "                     [--threads n] [--gravity msec]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    Worker *workers;
+    struct rlimit rl;
+    const char *path = NULL;
+    int t, port = 0, watch = 0, nthreads = 0;
+
+    for (t=1; t<argc; t++) {
+        if      (strcmp(argv[t], "--tcp")     == 0 && t+1 < argc) port     = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--unix")    == 0 && t+1 < argc) path     = argv[++t];
+        else if (strcmp(argv[t], "--watch")   == 0 && t+1 < argc) watch    = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--threads") == 0 && t+1 < argc) nthreads = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--gravity") == 0 && t+1 < argc && atol(argv[t+1]) > 0)
+            Ggravity = atol(argv[++t]);
+        else Usage();
+    }
+    if (!port && !path) port = 2323;
+    if (nthreads < 1) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;      /* (a session is an fd: as many as we may) */
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (port) Glisten[0] = ListenTCP(port);
+    if (path) Glisten[1] = ListenUnix(path);
+    if (watch) Glisten[2] = ListenTCP(watch);
+    if (!(workers = calloc(nthreads, sizeof(Worker)))) {
+        perror("tetris-server: calloc");
+        exit(1);
+    }
+    for (t=0; t<nthreads; t++) StartWorker(&workers[t]);
+    fprintf(stderr, "tetris-server: %d threads", nthreads);
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+        fprintf(stderr, ", %llu fds", (unsigned long long)rl.rlim_cur);
+    if (port) fprintf(stderr, ", telnet 127.0.0.1 %d", port);
+    if (path) fprintf(stderr, ", unix %s", path);
+    if (watch) fprintf(stderr, ", spectators 127.0.0.1 %d", watch);
+    fprintf(stderr, "\n");
+    for (t=0; t<nthreads; t++) pthread_join(workers[t].tid, NULL);
+    return(0);
+}
@@ -0,0 +1,173 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "libtetris.h"
+#include "bot.h"
+#include "plan.h"
+#include "pool.h"
+
+/***********************************************************************
+ *
+ * TETRIS-SIM - Play many headless bot games on every CPU
+ *
+ *     Each game is one task on a work stealing pool (pool.c), with its
+ *     own seed, so results don't depend on how the games got spread
+ *     over the threads. Prints rows and pieces per game, and games/sec:
+ *
+ *         tetris-sim [--games n] [--seed n] [--threads n] [--maxpieces n]
+ *                    [--weights height,lines,holes,bumpiness[,transitions]]
+ *                    [--depth n] [--table megabytes] [--budget-ms n]
+ *
+ *     --depth searches n shapes ahead (see BotSearch()); past 2 it gets
+ *     slow fast, and a --table shared by all the games saves searching
+ *     positions twice. Its hit rate and size are printed at the end.
+ *
+ *     --budget-ms plans each placement with Monte Carlo rollouts (see
+ *     plan.h) for n milliseconds instead. The rollouts use every
+ *     thread, so the games are played one at a time.
+ *
+ ***********************************************************************/
+
+/* ONE GAME'S TASK */
+typedef struct {
+    unsigned long long seed;
+    int rows, pieces;
+    long rollouts;                      /* (--budget-ms) */
+} SimGame;
+
+BotWeights Gweights;                    /* --weights */
+int        Gmaxpieces = 10000;          /* --maxpieces: stop a game that long */
+long       Gbudget = 0;                 /* --budget-ms: plan by rollouts (0: bot search) */
+
+/* PLAY ONE GAME TO THE END (pool task) */
+void PlayGame(void *arg, int worker)
+{
+    SimGame *s = (SimGame*)arg;
+    TetrisGame g;
+    TetrisPlacement p;
+    long n;
+    (void)worker;
+
+    TetrisInit(&g, s->seed);
+    while (!g.dead && g.pieces < Gmaxpieces) {
+        if (Gbudget) {
+            if ((n = PlanChoose(&g, &Gweights, Gbudget, &p)) == 0) break;
+            s->rollouts += n;
+        } else if (!BotChoose(&g, &Gweights, &p)) break;   /* nowhere to go */
+        TetrisPlace(&g, &p);
+    }
+    s->rows   = g.rows;
+    s->pieces = g.pieces;
+}
+
+/* SORT ROWS ASCENDING (qsort) */
+int CompareRows(const void *a, const void *b)
+{
+    return(((const SimGame*)a)->rows - ((const SimGame*)b)->rows);
+}
+
+/* ROW COUNT AT A PERCENTILE (games sorted) */
+int Percentile(const SimGame *games, int n, int pct)
+{
+    return(games[(long)(n-1) * pct / 100].rows);
+}
+
+/* PARSE --weights h,l,o,b[,t] (no t: the default's) */
+void ParseWeights(const char *s)
+{
+    int n = sscanf(s, "%lf,%lf,%lf,%lf,%lf", &Gweights.height, &Gweights.lines,
+                   &Gweights.holes, &Gweights.bumpiness, &Gweights.transitions);
+    if (n != 4 && n != 5) {
+        fprintf(stderr, "tetris-sim: --weights wants height,lines,holes,bumpiness[,transitions]\n");
+        exit(1);
+    }
+}
+
+/* WALL CLOCK SECONDS */
+double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+void Usage(void)
+{
+    fprintf(stderr, "usage: tetris-sim [--games n] [--seed n] [--threads n] [--maxpieces n]\n"
+                    "                  [--weights height,lines,holes,bumpiness[,transitions]]\n"
+                    "                  [--depth n] [--table megabytes] [--budget-ms n]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    SimGame *games;
+    Pool *pool;
+    unsigned long long seed = 1;
+    TableStats ts;
+    int t, ngames = 100, nthreads = 0, depth = 2, planthreads = 0;
+    double start, secs, rows = 0, pieces = 0, tablemb = 0, rollouts = 0;
+
+    Gweights = BotDefaultWeights;
+    for (t=1; t<argc; t++) {
+        if      (strcmp(argv[t], "--games")     == 0 && t+1 < argc) ngames     = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--seed")      == 0 && t+1 < argc) seed       = strtoull(argv[++t], NULL, 10);
+        else if (strcmp(argv[t], "--threads")   == 0 && t+1 < argc) nthreads   = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--maxpieces") == 0 && t+1 < argc) Gmaxpieces = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--weights")   == 0 && t+1 < argc) ParseWeights(argv[++t]);
+        else if (strcmp(argv[t], "--depth")     == 0 && t+1 < argc) depth      = atoi(argv[++t]);
+        else if (strcmp(argv[t], "--table")     == 0 && t+1 < argc) tablemb    = atof(argv[++t]);
+        else if (strcmp(argv[t], "--budget-ms") == 0 && t+1 < argc) Gbudget    = atol(argv[++t]);
+        else Usage();
+    }
+    if (ngames < 1 || depth < 1 || tablemb < 0 || Gbudget < 0) Usage();
+    BotSearch(depth, (size_t)(tablemb * 1024 * 1024));
+    if (Gbudget) {                      /* threads plan; games take turns */
+        planthreads = PlanStart(nthreads);
+        nthreads = 1;
+    }
+
+    if (!(games = calloc(ngames, sizeof(SimGame)))) {
+        perror("tetris-sim: calloc");
+        exit(1);
+    }
+    pool  = PoolCreate(nthreads);
+    start = Now();
+    for (t=0; t<ngames; t++) {
+        games[t].seed = seed + t;
+        PoolSubmit(pool, -1, PlayGame, &games[t]);
+    }
+    PoolWait(pool);
+    secs = Now() - start;
+    nthreads = Gbudget ? planthreads : PoolThreads(pool);
+    PoolDestroy(pool);
+
+    for (t=0; t<ngames; t++) {
+        rows     += games[t].rows;
+        pieces   += games[t].pieces;
+        rollouts += games[t].rollouts;
+    }
+    qsort(games, ngames, sizeof(SimGame), CompareRows);
+
+    printf("games %d, threads %d, %.2f secs, %.1f games/sec\n",
+           ngames, nthreads, secs, secs > 0 ? ngames / secs : 0.0);
+    printf("rows:   mean %.1f  min %d  p10 %d  p50 %d  p90 %d  p99 %d  max %d\n",
+           rows / ngames, games[0].rows,
+           Percentile(games, ngames, 10), Percentile(games, ngames, 50),
+           Percentile(games, ngames, 90), Percentile(games, ngames, 99),
+           games[ngames-1].rows);
+    printf("pieces: mean %.1f per game, %.0f pieces/sec\n",
+           pieces / ngames, secs > 0 ? pieces / secs : 0.0);
+    if (Gbudget)
+        printf("plan:   %ld ms a piece, %.0f rollouts a piece, %.0f rollouts/sec\n",
+               Gbudget, pieces > 0 ? rollouts / pieces : 0.0, secs > 0 ? rollouts / secs : 0.0);
+    if (BotTableStats(&ts))
+        printf("table:  %.1f MB, %llu probes, %.1f%% hits, %llu stores\n",
+               ts.bytes / (1024.0 * 1024.0), ts.probes,
+               ts.probes ? 100.0 * ts.hits / ts.probes : 0.0, ts.stores);
+    free(games);
+    return(0);
+}
@@ -0,0 +1,170 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "table.h"
+
+/***********************************************************************
+ *
+ * TABLE - Transposition table for searches (see table.h)
+ *
+ *     An entry is three words: the value's bits, 'meta' (depth in the
+ *     low byte, generation above) and check = key ^ value ^ meta. A
+ *     probe matches if the three XOR back to its key and the depth is
+ *     the one asked for, so a hit is exactly what searching would have
+ *     returned and results don't depend on what's in the table. Depth
+ *     0 is never stored, which makes a zeroed entry an empty one.
+ *
+ *     Words are loaded and stored relaxed (no ordering, just no tearing
+ *     of a word); the counters are relaxed atomic adds.
+ *
+ ***********************************************************************/
+
+#ifdef __GNUC__
+    #define LOAD(p)         __atomic_load_n(p, __ATOMIC_RELAXED)
+    #define STORE(p, v)     __atomic_store_n(p, v, __ATOMIC_RELAXED)
+    #define ADD(p, v)       __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+#else                                   /* (no threads search there) */
+    #define LOAD(p)         (*(p))
+    #define STORE(p, v)     (*(p) = (v))
+    #define ADD(p, v)       (*(p) += (v))
+#endif
+
+typedef struct {
+    unsigned long long check, value, meta;
+} TableEntry;
+
+struct Table {
+    TableEntry (*buckets)[2];           /* [0]: deepest this generation, [1]: latest */
+    unsigned long long n;               /* buckets */
+    unsigned long long gen;             /* TableAge() count */
+    unsigned long long probes, hits, stores;
+};
+
+/* SCRAMBLE 64 BITS (splitmix64's finalizer) */
+unsigned long long TableMix(unsigned long long x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return(x ^ (x >> 31));
+}
+
+/* ZOBRIST KEY FOR THE BOXES SET IN ROW y */
+static unsigned long long RowKeys(int y, Row bits)
+{
+    unsigned long long h = 0;
+    int x;
+    bits = (bits & FULLROW) >> FIELDSHIFT;
+    for (x=0; bits; x++, bits >>= 1)
+        if (bits & 1) h ^= TableMix(0x9E3779B97F4A7C15ULL * (unsigned long long)(y*GAMEWIDTH + x + 1));
+    return(h);
+}
+
+/* HASH A BOARD */
+unsigned long long TableHash(const Row board[GAMEHEIGHT])
+{
+    unsigned long long h = 0;
+    int y;
+    for (y=0; y<GAMEHEIGHT; y++) h ^= RowKeys(y, board[y]);
+    return(h);
+}
+
+/* HASH OF 'after', GIVEN 'h' IS THE HASH OF 'before'
+ *     Only the boxes that changed are looked at: a placement's four,
+ *     unless it completed rows and moved the ones above.
+ */
+unsigned long long TableRehash(unsigned long long h, const Row before[GAMEHEIGHT],
+                               const Row after[GAMEHEIGHT])
+{
+    int y;
+    for (y=0; y<GAMEHEIGHT; y++)
+        if (before[y] != after[y]) h ^= RowKeys(y, before[y] ^ after[y]);
+    return(h);
+}
+
+/* A KEY'S BUCKET (its top 32 bits scaled to 0..n-1) */
+static TableEntry *Bucket(Table *t, unsigned long long key)
+{
+    return(t->buckets[((key >> 32) * t->n) >> 32]);
+}
+
+/* MAKE A TABLE TAKING 'bytes' (1 to 2^32 buckets) */
+Table *TableCreate(size_t bytes)
+{
+    Table *t = calloc(1, sizeof(Table));
+    unsigned long long n = bytes / sizeof(t->buckets[0]);
+
+    if (n < 1) n = 1;
+    if (n > (1ULL << 32)) n = 1ULL << 32;
+    if (!t || !(t->buckets = calloc(n, sizeof(t->buckets[0])))) {
+        perror("table: calloc");
+        exit(1);
+    }
+    t->n   = n;
+    t->gen = 1;
+    return(t);
+}
+
+void TableDestroy(Table *t)
+{
+    free(t->buckets);
+    free(t);
+}
+
+/* START A NEW GENERATION (eg. a new search)
+ *     Older deep entries no longer hold their place against newer ones.
+ */
+void TableAge(Table *t)
+{
+    ADD(&t->gen, 1);
+}
+
+/* LOOK UP A POSITION SEARCHED 'depth' DEEP
+ *     Returns 1 with its value, or 0.
+ */
+int TableProbe(Table *t, unsigned long long key, int depth, double *value)
+{
+    TableEntry *e = Bucket(t, key);
+    unsigned long long v, m;
+    int i;
+
+    ADD(&t->probes, 1);
+    for (i=0; i<2; i++) {
+        v = LOAD(&e[i].value);
+        m = LOAD(&e[i].meta);
+        if ((LOAD(&e[i].check) ^ v ^ m) == key && (int)(m & 0xff) == depth) {
+            ADD(&t->hits, 1);
+            memcpy(value, &v, sizeof(double));
+            return(1);
+        }
+    }
+    return(0);
+}
+
+/* REMEMBER A POSITION'S VALUE (depth 1..255)
+ *     It takes the bucket's deep entry if that's from an older
+ *     generation or no deeper, else the latest one.
+ */
+void TableStore(Table *t, unsigned long long key, int depth, double value)
+{
+    TableEntry *e = Bucket(t, key);
+    unsigned long long v, m, gen = LOAD(&t->gen), old = LOAD(&e[0].meta);
+
+    memcpy(&v, &value, sizeof(double));
+    m = (gen << 8) | (unsigned long long)depth;
+    if ((old >> 8) == gen && (int)(old & 0xff) > depth) e++;
+    STORE(&e->check, key ^ v ^ m);
+    STORE(&e->value, v);
+    STORE(&e->meta,  m);
+    ADD(&t->stores, 1);
+}
+
+/* HIT RATE AND SIZE */
+void TableCount(const Table *t, TableStats *s)
+{
+    s->probes = t->probes;
+    s->hits   = t->hits;
+    s->stores = t->stores;
+    s->bytes  = t->n * sizeof(t->buckets[0]);
+}
@@ -0,0 +1,45 @@
+/* vim: autoindent tabstop=8 shiftwidth=4 expandtab softtabstop=4
+ */
+#ifndef TABLE_H
+#define TABLE_H
+#include <stddef.h>
+#include "libtetris.h"
+
+/***********************************************************************
+ *
+ * TABLE - Transposition table for searches, shared by their threads
+ *
+ *     Positions are hashed Zobrist style: a fixed random key per box of
+ *     the playfield, XORed together for the boxes that are set, so the
+ *     hash of the board after a placement is the old one XORed with the
+ *     keys of the boxes that changed (TableRehash()). The caller mixes
+ *     in whatever else the value depends on (active shape, depth..).
+ *
+ *     The table is a fixed size array of two entry buckets: the first
+ *     entry keeps the deepest search seen this generation, the second
+ *     whatever came last. Entries are written and read without locks;
+ *     each is stored with its key XORed into a check word, so one torn
+ *     by two threads writing it at once just doesn't match any key.
+ *
+ ***********************************************************************/
+
+typedef struct Table Table;
+
+typedef struct {
+    unsigned long long probes, hits, stores;
+    size_t bytes;                       /* memory the entries take */
+} TableStats;
+
+Table *TableCreate(size_t bytes);
+void   TableDestroy(Table *t);
+void   TableAge(Table *t);
+int    TableProbe(Table *t, unsigned long long key, int depth, double *value);
+void   TableStore(Table *t, unsigned long long key, int depth, double value);
+void   TableCount(const Table *t, TableStats *s);
+
+unsigned long long TableHash(const Row board[GAMEHEIGHT]);
+unsigned long long TableRehash(unsigned long long h, const Row before[GAMEHEIGHT],
+                               const Row after[GAMEHEIGHT]);
+unsigned long long TableMix(unsigned long long x);
+
+#endif /*TABLE_H*/
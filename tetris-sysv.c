@@ -2,7 +2,13 @@
  ***     Linux, and other non-BSD unix compatible terminals. ***
  ***                                                         ***/
 #include <stdio.h>
+#include <errno.h>
 #include <termio.h>
+#include <poll.h>
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/timerfd.h>
+#endif
 
 static struct termio G_tio,                       /* game settings */
                      G_tiosave;                   /* saved UNIX settings */
@@ -13,15 +19,32 @@ void EndTerminal(void)
     ioctl(fileno(stdin), TCSETA, &G_tiosave);     /* assert old settings */
 }
 
-/* WHEN USER HITS ^C -- WE MUST RESET TERMINAL BACK TO NORMAL */
+static int G_sigpipe[2] = { -1, -1 };             /* SIGINTTrap() -> WaitEvent() */
+
+/* WHEN USER HITS ^C -- WE MUST RESET TERMINAL BACK TO NORMAL
+ *     Not from here (that's not safe in a signal handler): the main
+ *     loop does it, in CheckSIGINT(). The byte down G_sigpipe wakes
+ *     WaitEvent()'s poll(), even if it wasn't in it yet.
+ */
 void SIGINTTrap()
 {
+    int err = errno;
+    signal(SIGINT, SIGINTTrap);
+    Gsigint = 1;
+    if (write(G_sigpipe[1], "", 1) < 0) { }       /* pipe full: it's awake already */
+    errno = err;
+}
+
+/* MAKE G_sigpipe AND CATCH ^C */
+static void TrapSIGINT(void)
+{
+    int t;
+    if (pipe(G_sigpipe) == 0)
+        for (t=0; t<2; t++) {
+            fcntl(G_sigpipe[t], F_SETFL, O_NONBLOCK);
+            fcntl(G_sigpipe[t], F_SETFD, FD_CLOEXEC);
+        }
     signal(SIGINT, SIGINTTrap);
-    EndTerminal();
-    ClearScreen();
-    fflush(stdout);
-    fprintf(stderr,"SIGINT: terminating\n");
-    exit(1);
 }
 
 /* FORCE UNIX TO READ TERMINAL KEYS NON-BUFFERED/NO ECHO */
@@ -33,53 +56,115 @@ void InitTerminal(void)
     G_tio.c_cc[VMIN]  = 0;                        /* No waiting */
     G_tio.c_cc[VTIME] = 0;                        /* No kidding */
     ioctl(fileno(stdin), TCSETA, &G_tio);         /* assert new settings */
-    signal(SIGINT, SIGINTTrap);
+    TrapSIGINT();
 }
 
-/* READ A SINGLE KEY (under UNIX)
- *     Returns a function number.
- */
-int ReadKey(void)
+/* MONOTONIC CLOCK IN MILLISECONDS */
+long NowMsec(void)
 {
-    static int esc = 0;
-    char c;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((long)ts.tv_sec*1000L + ts.tv_nsec/1000000L);
+}
 
-    if (read(fileno(stdin), &c, 1) != 1)       /* read character */
-        { USLEEP(500); return(0); }            /* none ready? return 0. usleep keeps cpu idle */
+#ifdef __linux__
+/*** GRAVITY TIMER: a monotonic timerfd that poll() can wait on ***/
+static int G_timerfd = -1;
 
-    /* Handle arrow keys -- these are 3 character sequences:
-     *    up=ESC[A, down=ESC[B, right=ESC[C, left=ESC[D
-     */
-    switch ( esc ) {
-        case 0: if ( c == 0x1b ) { esc = 1; return 0; }
-                break;     /* fall thru to normal char handling */
-        case 1: if ( c == '[' ) { esc = 2; return 0; }
-                esc = 0;   /* reset */
-                break;     /* fall thru to normal char handling */
-        case 2: {
-            int ret = 0;
-            /* LocateXY(1,1); printf("GOT '%c'\n", c); */
-            switch (c) {
-                case 'A': ret = ROTATE; break;  /*    UP KEY */
-                case 'B': ret = DOWN;   break;  /*  DOWN KEY */
-                case 'C': ret = RIGHT;  break;  /* RIGHT KEY */
-                case 'D': ret = LEFT;   break;  /*  LEFT KEY */
-            }
-            esc = 0;     /* last char in sequence, reset */
-            return ret;
-       }
+/* START THE PERIODIC GRAVITY TIMER */
+void StartTimer(long msec)
+{
+    struct itimerspec its;
+    if (G_timerfd < 0 &&
+        (G_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0) {
+        perror("timerfd_create");
+        exit(1);
     }
+    its.it_interval.tv_sec  = msec / 1000;
+    its.it_interval.tv_nsec = (msec % 1000) * 1000000L;
+    its.it_value            = its.it_interval;
+    timerfd_settime(G_timerfd, 0, &its, NULL);
+}
+
+/* BLOCK UNTIL A KEY IS WAITING OR THE GRAVITY TIMER EXPIRES
+ *     timer: 0 ignores the gravity timer.
+ *     msec: also return (with 0) after this long; -1 waits indefinitely.
+ *     Returns KEYEVENT and/or TIMEREVENT.
+ */
+int WaitEvent(int timer, long msec)
+{
+    struct pollfd fds[3];
+    uint64_t expired;
+    long until = (msec < 0) ? -1 : NowMsec() + msec;
+    int ret = 0;
+
+    if (KeysBuffered()) return(KEYEVENT);             /* (read already) */
+    fds[0].fd = fileno(stdin);  fds[0].events = POLLIN;
+    fds[1].fd = G_sigpipe[0];   fds[1].events = POLLIN;
+    fds[2].fd = G_timerfd;      fds[2].events = POLLIN;
+    while (!ret && !Gsigint) {                        /* (^C: CheckSIGINT()'s turn) */
+        if (until >= 0 && (msec = until - NowMsec()) < 0) msec = 0;
+        if (poll(fds, timer ? 3 : 2, (int)msec) < 0) continue;  /* EINTR */
+        if (fds[0].revents & (POLLHUP|POLLERR|POLLNVAL)) {
+            EndTerminal();
+            fprintf(stderr, "tty hangup: terminating\n");
+            exit(1);
+        }
+        if (fds[0].revents & POLLIN) ret |= KEYEVENT;
+        if (timer && (fds[2].revents & POLLIN) &&
+            read(G_timerfd, &expired, sizeof(expired)) == sizeof(expired))
+            ret |= TIMEREVENT;
+        if (until >= 0 && NowMsec() >= until) break;
+    }
+    return(ret);
+}
+#else
+/*** GRAVITY TIMER: poll() timeout against the monotonic clock ***/
+static long G_period = 1000,                      /* gravity period (msec) */
+            G_deadline;                           /* next gravity (msec) */
+
+/* START THE PERIODIC GRAVITY TIMER */
+void StartTimer(long msec)
+{
+    G_period   = msec;
+    G_deadline = NowMsec() + msec;
+}
+
+/* BLOCK UNTIL A KEY IS WAITING OR THE GRAVITY TIMER EXPIRES
+ *     timer: 0 ignores the gravity timer.
+ *     msec: also return (with 0) after this long; -1 waits indefinitely.
+ *     Returns KEYEVENT and/or TIMEREVENT.
+ */
+int WaitEvent(int timer, long msec)
+{
+    struct pollfd fds[2];
+    long now, wait, until = (msec < 0) ? -1 : NowMsec() + msec;
+    int ret = 0;
 
-    esc = 0;
-    switch(c) {
-        case  'q': return(QUIT);
-        case  'j': return(DOWN);
-        case  'h': return(LEFT);
-        case  'l': return(RIGHT);
-        case  'p': return(PAUSE);
-        case  'z': return(TEST);
-        case  ' ': return(ROTATE);
-        case  'r': return(REDRAW);
+    if (KeysBuffered()) return(KEYEVENT);             /* (read already) */
+    fds[0].fd = fileno(stdin); fds[0].events = POLLIN;
+    fds[1].fd = G_sigpipe[0];  fds[1].events = POLLIN;
+    while (!ret && !Gsigint) {                        /* (^C: CheckSIGINT()'s turn) */
+        now  = NowMsec();
+        wait = -1;                                      /* (forever) */
+        if (timer)
+            wait = (G_deadline > now) ? G_deadline - now : 0;
+        if (until >= 0 && (wait < 0 || until - now < wait))
+            wait = (until > now) ? until - now : 0;
+        if (poll(fds, 2, (int)wait) < 0) continue;      /* EINTR */
+        if (fds[0].revents & (POLLHUP|POLLERR|POLLNVAL)) {
+            EndTerminal();
+            fprintf(stderr, "tty hangup: terminating\n");
+            exit(1);
+        }
+        if (fds[0].revents & POLLIN) ret |= KEYEVENT;
+        if (timer && (now = NowMsec()) >= G_deadline) {
+            G_deadline += G_period;
+            if (G_deadline <= now) G_deadline = now + G_period;     /* fell behind */
+            ret |= TIMEREVENT;
+        }
+        if (until >= 0 && now >= until) break;
     }
-    return(0);
+    return(ret);
 }
+#endif
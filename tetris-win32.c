@@ -53,3 +53,64 @@ void EndTerminal(void)
 }
 
 
+
+/*** GRAVITY TIMER: console input handle wait against the tick count ***/
+static DWORD G_period = 1000,                      /* gravity period (msec) */
+             G_deadline;                           /* next gravity (msec) */
+
+/* MONOTONIC CLOCK IN MILLISECONDS */
+long NowMsec(void)
+{
+    return((long)GetTickCount());
+}
+
+/* START THE PERIODIC GRAVITY TIMER */
+void StartTimer(long msec)
+{
+    G_period   = (DWORD)msec;
+    G_deadline = GetTickCount() + G_period;
+}
+
+/* THROW AWAY CONSOLE INPUT THAT ISN'T A KEY
+ *     Key-ups, shift/ctrl on their own, focus, mouse and resize events
+ *     stay queued (_kbhit() only peeks past them) and keep the input
+ *     handle signaled, so the wait would return at once forever. Until
+ *     there's a key getch() can read, they're read off the front of
+ *     the queue one at a time (a key typed meanwhile goes behind them).
+ */
+static void DropNonKeys(HANDLE hStdin)
+{
+    INPUT_RECORD rec;
+    DWORD n;
+    while (!_kbhit() && PeekConsoleInput(hStdin, &rec, 1, &n) && n == 1)
+        ReadConsoleInput(hStdin, &rec, 1, &n);
+}
+
+/* BLOCK UNTIL A KEY IS WAITING OR THE GRAVITY TIMER EXPIRES
+ *     timer: 0 ignores the gravity timer.
+ *     msec: also return (with 0) after this long; -1 waits indefinitely.
+ *     Returns KEYEVENT and/or TIMEREVENT.
+ */
+int WaitEvent(int timer, long msec)
+{
+    HANDLE hStdin = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD now, wait, until = GetTickCount() + (DWORD)msec;
+    int ret = 0;
+
+    while (!ret) {
+        now  = GetTickCount();
+        wait = !timer ? INFINITE : ((long)(G_deadline - now) > 0) ? G_deadline - now : 0;
+        if (msec >= 0 && (wait == INFINITE || (long)(until - now) < (long)wait))
+            wait = ((long)(until - now) > 0) ? until - now : 0;
+        WaitForSingleObject(hStdin, wait);      /* signaled by any console input */
+        DropNonKeys(hStdin);                    /* (so it's only signaled by keys) */
+        if (_kbhit()) ret |= KEYEVENT;
+        if (timer && (long)((now = GetTickCount()) - G_deadline) >= 0) {
+            G_deadline += G_period;
+            if ((long)(G_deadline - now) <= 0) G_deadline = now + G_period;   /* fell behind */
+            ret |= TIMEREVENT;
+        }
+        if (msec >= 0 && (long)(GetTickCount() - until) >= 0) break;
+    }
+    return(ret);
+}
@@ -2,8 +2,14 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 #include <time.h>
+#include "libtetris.h"
+#include "bot.h"
+#include "replay.h"
+#include "screen.h"
+#include "hist.h"
 
 #define VERSION "1.33"
 
@@ -33,305 +39,393 @@
 
 /* PLATFORM SPECIFIC */
 #ifdef _WIN32
-    #include <windows.h>                /* Sleep(msec) */
+    #include <windows.h>                /* WaitForSingleObject() */
     #include <conio.h>                  /* _kbhit() */
-    #define USLEEP(val) Sleep(val/1000) /* microsecs -> millisec */
 #else
-    #include <unistd.h>                 /* usleep() */
-    #define USLEEP(val) usleep(val)     /* microsecs */
+    #include <unistd.h>                 /* read(), write(), pipe() */
+    #include <fcntl.h>                  /* fcntl() */
+    #include <pthread.h>                /* render thread */
+    #include <stdatomic.h>              /* its frame ring */
 #endif
 
-/* KEYSTROKE TRANSLATIONS */
-#define DOWN   1
-#define LEFT   2
-#define RIGHT  3
-#define ROTATE 4
-#define QUIT   5
-#define PAUSE  6
-#define TEST   7
-#define REDRAW 8
-
-/* REDRAW MODES */
-#define CHANGED 0               /* redraw only whats changed */
-#define WINDOW  1               /* redraw only outer window (and score/preview) */
-#define GSCREEN 2               /* redraw only playing screen */
-#define ALL     WINDOW|GSCREEN  /* complete redraw */
-
-/* SCREEN PIXELS */
-#define NOSHAPECOLOR    "  "
-#define VTSHAPECOLOR    "\33[7m##\33[0m"
-#define WYSHAPECOLOR    "\33`6\33)##\33("
-
-/* SHAPE/SCREEN ORIENTATION */
-#define GAMEHEIGHT      20
-#define GAMEWIDTH       10
-#define TOPOFFSET       2
-#define PREVIEWYOFFSET  15
-#define PREVIEWXOFFSET  47
-#define LEFTOFFSET      20
-#define MAXSHAPES       7
-#define SHAPEMAX        4       /* width/height of shape characters */
-
-/* GSCREEN PIXEL BIT PLANES */
-#define NOSHAPE         0       /* empty space */
-#define NEWSHAPE        1       /* current moving shape */
-#define OLDSHAPE        2       /* last moving shape */
-#define COLLIDESHAPE    3       /* new & last shape collision */
-#define PETRIFIEDSHAPE  4       /* petrified into position */
-
-#define ABS(a)          (((a)<0)?-(a):(a))
-#define SGN(a)          (((a)<0)?(-1):1)         /* binary sign of a: -1, 1 */
-#define ZSGN(a)         (((a)<0)?(-1):(a)>0?1:0) /* sign of a: -1, 0, 1 */
+/* WaitEvent() FLAGS */
+#define KEYEVENT    1           /* a key is waiting */
+#define TIMEREVENT  2           /* gravity timer expired */
 
 /* GLOBALS */
 char *Gterm = 0;
-char *Gwindow[] = {
-"\t\t ::::::::::::::::::::::::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::              ",
-"\t\t ::                    ::    ..........",
-"\t\t ::                    ::    :        :",
-"\t\t ::                    ::    :        :",
-"\t\t ::                    ::    :        :",
-"\t\t ::                    ::    :        :",
-"\t\t ::                    ::    :        :",
-"\t\t ::                    ::    :        :",
-"\t\t ::                    ::    :........:",
-"\t\t ::                    ::              ",
-"\t\t ::::::::::::::::::::::::    Rows =    ",
-NULL
-};
-
-/* SHAPE TABLES (Indexing: [shape] [y] [rotation] [x]) */
-char *Gshapes[MAXSHAPES+1][4][4] = {    /* shape icons */
-  {
-    { "    ", "    ", "    ", "    " }, /* 4 rotated positions of each shape */
-    { " ## ", " ## ", " ## ", " ## " },
-    { " ## ", " ## ", " ## ", " ## " },
-    { "    ", "    ", "    ", "    " },
-  },{
-    { "    ", " #  ", " #  ", " #  " },
-    { "### ", " ## ", "### ", "##  " },
-    { " #  ", " #  ", "    ", " #  " },
-    { "    ", "    ", "    ", "    " },
-  },{
-    { "    ", " #  ", "    ", " #  " },
-    { "####", " #  ", "####", " #  " },
-    { "    ", " #  ", "    ", " #  " },
-    { "    ", " #  ", "    ", " #  " },
-  },{
-    { "    ", " #  ", "  # ", "##  " },
-    { "### ", " #  ", "### ", " #  " },
-    { "#   ", " ## ", "    ", " #  " },
-    { "    ", "    ", "    ", "    " },
-  },{
-    { "    ", " ## ", "#   ", " #  " },
-    { "### ", " #  ", "### ", " #  " },
-    { "  # ", " #  ", "    ", "##  " },
-    { "    ", "    ", "    ", "    " },
-  },{
-    { " ## ", " #  ", " ## ", " #  " },
-    { "##  ", " ## ", "##  ", " ## " },
-    { "    ", "  # ", "    ", "  # " },
-    { "    ", "    ", "    ", "    " },
-  },{
-    { "##  ", "  # ", "##  ", "  # " },
-    { " ## ", " ## ", " ## ", " ## " },
-    { "    ", " #  ", "    ", " #  " },
-    { "    ", "    ", "    ", "    " },
-  }
-};
 
 /* GLOBAL VARIABLES */
-int Gnextshape,                         /* the next shape coming */
-    Gshape,                             /* current shape (0 if none selected) */
-    Gx,Gy,Grotate,                      /* current shape's orientation */
-    Grows=0,                            /* completed rows (score) */
-    Glastrows=0,                        /* (last displayed score) */
-    Gtest=0;                            /* test mode */
+TetrisGame Ggame;                       /* the game being played */
+int  Gtest=0;                           /* test mode */
+long Ggravity=1000;                     /* msecs between gravity drops */
+int  Gseeded = 0;                       /* --seed given? */
+unsigned long long Gseed = 0;           /* --seed: the game's shape sequence */
+TetrisInput Gqueue;                     /* button events not yet given to the engine */
+int  Gflash = 0;                        /* next row flash step (0: not flashing) */
+long Gflashdue = 0;                     /* NowMsec() when that step is due */
+int  Gbot = 0;                          /* --bot: the game plays itself */
+long Gbotmsec = 0,                      /* msecs between bot keys */
+     Gbotdue  = 0;                      /* NowMsec() when the next one is due */
+int  Gbotpiece = -1;                    /* Ggame.pieces when Gbottarget was picked */
+TetrisPlacement Gbottarget;             /* where the bot is taking the shape */
+char *Grecord = 0;                      /* --record: file to record the game to */
+ReplayWriter Grec;                      /* (the recording) */
+long  Gstartms = 0;                     /* NowMsec() when the game started */
+char *Greplay = 0;                      /* --replay: file to play back */
+ReplayReader Gplay;                     /* (the replay) */
+long  Gseek  = 0;                       /* --seek: msecs into the replay to start at */
+double Gspeed = 1.0;                    /* --speed: replay speed */
+long  Gflashmsec;                       /* msecs per row flash step */
+char *Gstats = 0;                       /* --stats: file to dump the histograms to */
+volatile sig_atomic_t Gsigint = 0;      /* ^C: quit (from the main loop) */
+
+/* FRAME OUTPUT BUFFER
+ *     Everything drawn for a frame is collected in Gframe[] and sent to
+ *     the terminal in one write() by ScreenFlush(), so a frame never goes
+ *     out in pieces.
+ */
+#define FRAMEMAX        8192
 
-char Gscreen[GAMEHEIGHT][GAMEWIDTH];    /* game screen's memory space */
+char   Gframe[FRAMEMAX];                /* frame being built */
+Screen Gscreen;                         /* the terminal (drawn by the render thread) */
 
-/* CLEAR THE TERMINAL SCREEN */
-void ClearScreen(void)
+/* WRITE A FRAME TO THE TERMINAL (ScreenWriter) */
+static int WriteFrame(void *arg, const char *buf, int len)
 {
-    if (Gterm) {
-        if (Gterm[0]=='w' && Gterm[1]=='y') {   /* WYSE TERMINALS */
-            printf("%c%c%c\r",0x1b,0x28,0x1a);  /* CLEAR */
-            printf("%c",0x1e);                  /* HOME */
-            /* printf("%c%c%c%c",0x1b,0x3d,0x20,0x20); */
-            return;
-        }
+    int n, off = 0, writes = 0;
+    (void)arg;
+    while (off < len) {
+#ifdef _WIN32
+        n = (int)fwrite(buf+off, 1, len-off, stdout);
+        fflush(stdout);
+#else
+        n = (int)write(fileno(stdout), buf+off, len-off);
+#endif
+        ++writes;
+        if (n <= 0) break;              /* tty gone? drop the frame */
+        off += n;
     }
-
-    /* CLEAR/HOME FOR VT100/IRIS-ANSI/IBMPC-ANSI TERMINALS */
-    printf("\33[2J\33[1;1H\r");
+    return(writes);
 }
 
-/* LOCATE THE CURSOR ON THE TERMINAL SCREEN */
-void LocateXY(int x, int y)      /* x: 1-80, y:1-24 */
+/* INSTRUMENTATION (--stats)
+ *     Where the time goes, in fixed size histograms (hist.h):
+ *
+ *         keylatency    a move key read by ReadKey() to the frame showing it flushed
+ *         handleshape   HandleShape(): the engine step, recording, flash start
+ *         collision     engine steps that only moved the shape (collision checks)
+ *         completedrows engine steps that completed rows (petrify + row deletion)
+ *         framebytes    bytes sent to the terminal per frame
+ *         gravityjitter how far each gravity tick was off the --gravity period
+ *
+ *     They're written to the --stats file as JSON on exit, and on SIGUSR1
+ *     (at the next key or gravity tick). Frames are drawn on the render
+ *     thread, so its histograms are only touched under G_statslock.
+ */
+#define STATKEY         0
+#define STATSHAPE       1
+#define STATCOLLIDE     2
+#define STATROWS        3
+#define STATBYTES       4
+#define STATJITTER      5
+#define NSTATS          6
+
+Hist Gstat[NSTATS];
+long long Gkeyns = 0;                   /* HistNow() of the oldest move not drawn yet */
+long long Glastgravity = 0;             /* HistNow() of the last gravity tick (0: none) */
+volatile sig_atomic_t Gdumpstats = 0;   /* SIGUSR1 asked for a dump */
+
+#ifndef _WIN32
+static pthread_mutex_t G_statslock = PTHREAD_MUTEX_INITIALIZER;
+#define STATSLOCK()     pthread_mutex_lock(&G_statslock)
+#define STATSUNLOCK()   pthread_mutex_unlock(&G_statslock)
+#else
+#define STATSLOCK()
+#define STATSUNLOCK()
+#endif
+
+#ifdef SIGUSR1
+/* SIGUSR1: DUMP THE HISTOGRAMS (from the main loop) */
+static void SIGUSR1Trap(int sig)
 {
-    if (Gterm && Gterm[0]=='w') {               /* WYSE TERMINALS */
-        printf("%c%c%c%c",0x1b, 0x3d, 0x20+y-1, 0x20+x-1);
-    } else {
-        printf("\33[%d;%dH",y,x);               /* VT100/IBMPC/etc */
-    }
+    (void)sig;
+    Gdumpstats = 1;
 }
+#endif
 
-/* DRAW A PIXEL ON THE TERMINAL AT CURRENT CURSOR POSITION
- *     on: 1=pixel is on, 0=pixel is off
- */
-void DrawPixel(int on)
+/* START COUNTING */
+void StatsStart(void)
 {
-    if (on) printf("%s",(Gterm && Gterm[0]=='w') ? WYSHAPECOLOR : VTSHAPECOLOR);
-    else    printf("%s",NOSHAPECOLOR);
+    HistInit(&Gstat[STATKEY],     "keylatency",    "ns");
+    HistInit(&Gstat[STATSHAPE],   "handleshape",   "ns");
+    HistInit(&Gstat[STATCOLLIDE], "collision",     "ns");
+    HistInit(&Gstat[STATROWS],    "completedrows", "ns");
+    HistInit(&Gstat[STATBYTES],   "framebytes",    "bytes");
+    HistInit(&Gstat[STATJITTER],  "gravityjitter", "ns");
+#ifdef SIGUSR1
+    signal(SIGUSR1, SIGUSR1Trap);
+#endif
 }
 
-/* DRAW THE SHAPE THAT IS BEING "PREVIEWED" IN THE RIGHT HAND BOX */
-void DrawPreview(void)
+/* WRITE THE HISTOGRAMS TO THE --stats FILE */
+void StatsDump(void)
 {
-    int x,y;
-    for (y=0; y<SHAPEMAX; y++) {
-        LocateXY(PREVIEWXOFFSET,y+PREVIEWYOFFSET+1);
-        for (x=0; x<SHAPEMAX; x++)
-            DrawPixel( (Gshapes[Gnextshape][y][0][x]=='#') ? 1 : 0 );
+    FILE *fp;
+    int t;
+
+    Gdumpstats = 0;
+    if (!Gstats || !(fp = fopen(Gstats, "w"))) return;
+    STATSLOCK();
+    fprintf(fp, "{\"seed\": %llu, \"rows\": %d, \"pieces\": %d, \"gravity\": %ld,\n"
+                "\"histograms\": [\n",
+            Ggame.seed, Ggame.rows, Ggame.pieces, Ggravity);
+    for (t=0; t<NSTATS; t++) {
+        HistJSON(fp, &Gstat[t]);
+        fprintf(fp, "%s\n", (t < NSTATS-1) ? "," : "");
     }
+    fprintf(fp, "]}\n");
+    STATSUNLOCK();
+    fclose(fp);
 }
 
-/* UPDATE SCORE IF CHANGED (or forced to update) */
-void UpdateScore(int force)
+/* COUNT A GRAVITY TICK'S JITTER */
+void StatsGravity(void)
 {
-    if (force || Grows!=Glastrows) {
-        LocateXY(54,22);
-        printf("%d ",Grows);
-        Glastrows = Grows;
-    }
+    long long now = HistNow();
+    if (Glastgravity)
+        HistAdd(&Gstat[STATJITTER], llabs(now - Glastgravity - Ggravity * 1000000LL));
+    Glastgravity = now;
 }
 
-/* COME UP WITH A NEW SHAPE */
-void MakeNewShape(int update)
+/* SCREEN FRAMES
+ *     The game never draws the screen itself. Redraw() and the row flash
+ *     describe what it should look like as a Frame (screen.h) and hand
+ *     it to the render thread, which does all the terminal output. A
+ *     terminal (or ssh pipe) that backs up only holds up the render
+ *     thread; gravity and keys carry on.
+ *
+ *     Frames go through a lock-free single producer/single consumer ring
+ *     (FRAMEQUEUE). A render thread that falls behind merges all the
+ *     frames waiting into one and draws that. If the ring fills, the
+ *     game thread merges frames into G_pending until there's room.
+ *
+ *     On Windows (or if the thread can't start) frames are drawn as
+ *     soon as they're made.
+ */
+
+/* DRAW A FRAME ON THE TERMINAL (and count its cost) */
+static void DrawFrame(const Frame *f)
 {
-    Grotate    = 0;
-    Gx         = GAMEWIDTH/2 - SHAPEMAX/2;
-    Gy         = -3;
-    Gshape     = Gnextshape;
-    Gnextshape = (rand() % MAXSHAPES);
-    if (update) DrawPreview();
-    return;
+    ScreenDraw(&Gscreen, f);
+    if (!Gstats) return;
+    STATSLOCK();
+    HistAdd(&Gstat[STATBYTES], Gscreen.framebytes);
+    if (f->keyns) HistAdd(&Gstat[STATKEY], HistNow() - f->keyns);
+    STATSUNLOCK();
 }
 
-/* REDRAW THE SCREEN
- * 'all' bit flags:
- *     0       -- draws moving shape + score
- *     WINDOW  -- clear screen, redraw game's Gwindow[] outline, score+preview.
- *     GSCREEN -- redraw the Gscreen[] buffer of pieces, score+preview.
+#ifndef _WIN32
+/* RENDER THREAD (POSIX threads)
+ *     G_tail is only written by the game thread, G_head only by the
+ *     render thread; each slot is handed over by the release/acquire
+ *     pair on those. A byte down the G_wake pipe wakes the render thread.
  */
-void Redraw(int all)
+#define FRAMEQUEUE      64      /* frames the render thread can fall behind */
+#define RETRYMSEC       10      /* how soon to retry a frame the ring had no room for */
+
+static Frame       G_queue[FRAMEQUEUE];
+static atomic_uint G_head,                  /* next frame to draw */
+                   G_tail;                  /* next free slot */
+static atomic_int  G_quit;                  /* RenderStop(): draw what's left, then exit */
+static int         G_wake[2] = { -1, -1 };  /* pipe: game thread -> render thread */
+static pthread_t   G_render;
+static int         G_rendering = 0;         /* render thread running? */
+static Frame       G_pending;               /* merged frames waiting for room.. */
+static int         G_haspending = 0;        /* ..if any */
+
+/* QUEUE A FRAME FOR THE RENDER THREAD
+ *     Returns 0 if the ring is full.
+ */
+static int PushFrame(const Frame *f)
 {
-    int x,y;
-    char flags;
-
-    /* REDRAW WINDOW
-     *    Outline for game + preview + "Rows ="
-     */
-    if (all & WINDOW) {
-        ClearScreen();
-        for (y=0; Gwindow[y]; y++)
-            printf("%s\n",Gwindow[y]);
-    }
+    unsigned tail = atomic_load_explicit(&G_tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&G_head, memory_order_acquire) == FRAMEQUEUE)
+        return(0);
+    G_queue[tail % FRAMEQUEUE] = *f;
+    atomic_store_explicit(&G_tail, tail+1, memory_order_release);
+    if (write(G_wake[1], "", 1) < 0) { }    /* pipe full: it's awake already */
+    return(1);
+}
 
-    /* REDRAW SCREEN BUFFER
-     *    Redraws all pieces
-     */
-    if (all & GSCREEN) {
-        for (y=0; y<GAMEHEIGHT; y++) {
-            LocateXY(LEFTOFFSET,y+TOPOFFSET);
-            for (x=0; x<GAMEWIDTH; x++)
-                DrawPixel((Gscreen[y][x]==NOSHAPE)?0:1);
+/* DRAW FRAMES AS THEY COME (the render thread) */
+static void *RenderThread(void *arg)
+{
+    char buf[64];
+    Frame f;
+    unsigned head, tail;
+    int quit, have;
+    (void)arg;
+
+    while (1) {
+        if (read(G_wake[0], buf, sizeof(buf)) < 0) { }     /* sleep 'til poked */
+        quit = atomic_load_explicit(&G_quit, memory_order_acquire);
+        head = atomic_load_explicit(&G_head, memory_order_relaxed);
+        tail = atomic_load_explicit(&G_tail, memory_order_acquire);
+        for (have=0; head != tail; head++, have=1) {        /* behind? merge them */
+            if (have) FrameMerge(&f, &G_queue[head % FRAMEQUEUE]);
+            else      f = G_queue[head % FRAMEQUEUE];
         }
+        atomic_store_explicit(&G_head, head, memory_order_release);
+        if (have) DrawFrame(&f);
+        if (quit) break;
     }
+    return(NULL);
+}
+#endif
 
-    /* DRAW TEST SCREEN (DEBUGGING) */
-    if (Gtest) {
-        for (y=0; y<GAMEHEIGHT; y++) {
-            LocateXY(0,y+TOPOFFSET);
-            for (x=0; x<GAMEWIDTH; x++)
-                printf("%d",Gscreen[y][x]);
-        }
+/* START THE RENDER THREAD */
+void RenderStart(void)
+{
+#ifndef _WIN32
+    sigset_t all, old;
+
+    if (pipe(G_wake) < 0) return;           /* draw without one */
+    fcntl(G_wake[1], F_SETFL, O_NONBLOCK);
+    sigfillset(&all);                       /* signals stay with the game thread */
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    G_rendering = (pthread_create(&G_render, NULL, RenderThread, NULL) == 0);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+#endif
+}
+
+/* STOP THE RENDER THREAD, ONCE IT'S DRAWN EVERYTHING SENT
+ *     After this it's safe to draw from the game thread (Texit()).
+ */
+void RenderStop(void)
+{
+#ifndef _WIN32
+    if (!G_rendering) return;
+    G_rendering = 0;
+    atomic_store_explicit(&G_quit, 1, memory_order_release);
+    if (write(G_wake[1], "", 1) < 0) { }
+    pthread_join(G_render, NULL);
+    if (G_haspending) {                     /* (newer than what was queued) */
+        G_haspending = 0;
+        DrawFrame(&G_pending);
     }
+#endif
+}
 
-    if (all) {
-        UpdateScore(1);
-        DrawPreview();
-    } else {
-        for (y=0; y<GAMEHEIGHT; y++) {
-            for (x=0; x<GAMEWIDTH; x++) {
-                flags = Gscreen[y][x] & (COLLIDESHAPE^0xffff);
-                switch(Gscreen[y][x]&COLLIDESHAPE) {
-                    /* NEWLY DRAWN */
-                    case NEWSHAPE:
-                        LocateXY(x*2+LEFTOFFSET,y+TOPOFFSET);
-                        DrawPixel(1);
-                        Gscreen[y][x] = OLDSHAPE|flags;
-                        break;
-
-                    /* LEFTOVER TO BE ERASED */
-                    case OLDSHAPE:
-                        LocateXY(x*2+LEFTOFFSET,y+TOPOFFSET);
-                        DrawPixel(0);
-                        Gscreen[y][x] = NOSHAPE|flags;
-                        break;
-
-                    /* OVERLAPPED LAST SHAPE */
-                    case COLLIDESHAPE:
-                        Gscreen[y][x] = OLDSHAPE|flags;
-                        break;
-                }
-            }
+/* SEND A FRAME TO BE DRAWN */
+void SendFrame(Frame *f)
+{
+    f->test = Gtest;
+#ifndef _WIN32
+    if (G_rendering) {
+        if (G_haspending) {                 /* keep the order: older frames first */
+            FrameMerge(&G_pending, f);
+            G_haspending = !PushFrame(&G_pending);
+        } else if (!PushFrame(f)) {
+            G_pending    = *f;
+            G_haspending = 1;
         }
-        UpdateScore(0);
+        return;
     }
-    LocateXY(1,1);
-    fflush(stdout);
+#endif
+    DrawFrame(f);
 }
 
+/* RETRY A FRAME THAT WAS WAITING FOR ROOM
+ *     Returns how long the caller can sleep: 'msec' (-1: forever),
+ *     or less if a frame still needs sending.
+ */
+long FrameWait(long msec)
+{
+#ifndef _WIN32
+    if (G_haspending && PushFrame(&G_pending)) G_haspending = 0;
+    if (G_haspending && (msec < 0 || msec > RETRYMSEC)) return(RETRYMSEC);
+#endif
+    return(msec);
+}
+
+/* REDRAW THE SCREEN
+ * 'all' bit flags:
+ *     0       -- draws rows the engine marked dirty + score
+ *     WINDOW  -- clear screen, redraw game's Gwindow[] outline, pieces, score+preview.
+ *     GSCREEN -- redraw all the pieces, score+preview.
+ */
+void Redraw(int all)
+{
+    Frame f;
+
+    FrameCompose(&f, &Ggame, all);
+    f.keyns = Gkeyns;                   /* (shows any moves since the last) */
+    Gkeyns  = 0;
+    SendFrame(&f);
+}
 /* CLEAR THE GAME/INITIALIZE VARIABLES */
 void Clear(void)
 {
     time_t lt;
 
-    Gnextshape= 0;
-    Gshape    = 0;
-    Gx        = 0;
-    Gy        = -3;
-    Grotate   = 0;
-    Grows     = 0;
-    Glastrows = -1;
-
-    time(&lt);
-    srand((int)lt);
-
-    /* CLEAR THE GAME SCREEN BITMAP */
-    {
-        int x,y;
-        for (x=0; x<GAMEWIDTH; x++)
-            for (y=0; y<GAMEHEIGHT; y++)
-                Gscreen[y][x] = NOSHAPE;
+    if (!Gseeded) {                     /* a different game each time */
+        time(&lt);
+        Gseed = (unsigned long long)lt;
     }
-    MakeNewShape(0);     /* new shape */
-    MakeNewShape(0);     /* and another for preview */
+    TetrisInit(&Ggame, Gseed);
+
     Redraw(ALL);
 }
 
+#ifndef _WIN32
+/* KEY INPUT (UNIX)
+ *     Keys are read a buffer at a time: one read() per wakeup takes
+ *     everything typed (a whole arrow key sequence, a burst of auto
+ *     repeat, a paste), and ReadKey() hands the keys out of G_keys[]
+ *     one by one. An escape sequence cut off at the end of a read is
+ *     finished by the next, as ScreenKey() keeps its state. WaitEvent()
+ *     doesn't wait while keys are left in the buffer.
+ */
+#define KEYSMAX     256
+
+static char G_keys[KEYSMAX];            /* bytes read.. */
+static int  G_keyhead = 0,              /* ..the next to decode */
+            G_keylen  = 0;              /* ..how many */
+static int  G_keysread = 0;             /* read() done for this batch of keys */
+
+/* KEYS READ BUT NOT DECODED YET? */
+static int KeysBuffered(void)
+{
+    return(G_keyhead < G_keylen);
+}
+
+/* NEXT KEY
+ *     Returns a function number, or 0 once the keys read are used up.
+ *     Reads more only when asked for a key with the buffer empty, so a
+ *     caller looping 'til 0 costs one read().
+ */
+int ReadKey(void)
+{
+    int k, n;
+
+    while (1) {
+        while (G_keyhead < G_keylen)
+            if ((k = ScreenKey(&Gscreen, G_keys[G_keyhead++])))
+                return(k);              /* (arrow keys are escape sequences) */
+        if (G_keysread) {               /* that's all of this batch */
+            G_keysread = 0;
+            return(0);
+        }
+        G_keyhead = G_keylen = 0;
+        if ((n = (int)read(fileno(stdin), G_keys, KEYSMAX)) <= 0)
+            return(0);                  /* none ready */
+        G_keylen   = n;
+        G_keysread = 1;
+    }
+}
+#endif
+
 #ifdef _WIN32
 #include "tetris-win32.c"
 #endif
@@ -344,215 +438,255 @@ void Clear(void)
 #include "tetris-sysv.c"
 #endif
 
-time_t lasttime=0;
-
-/* HANDLE TIMER FOR SHAPE DROPPING
- * Returns '1' if shape should be moved
+/* QUIT IF ^C WAS HIT
+ *     SIGINTTrap() only sets Gsigint, and WaitEvent() returns early
+ *     for it; the loops that wait call this to put the terminal back.
  */
-int HandleTimer(int *yforce)
+void CheckSIGINT(void)
 {
-    time_t lt;
-    time(&lt);
-    if (lt!=lasttime) { lasttime = lt; if (yforce) *yforce = 1; return(1); }
-    else              { if (yforce) *yforce = 0; return(0); }
+    if (!Gsigint) return;
+    EndTerminal();
+    RenderStop();
+    ScreenClear(&Gscreen);
+    ScreenFlush(&Gscreen);
+    if ( Gstats ) StatsDump();
+    fprintf(stderr,"SIGINT: terminating\n");
+    exit(1);
 }
 
 /* EXIT PROGRAM WITH SCORE SHOWN */
 void Texit(char *msg, int v)
 {
-    //ClearScreen();
-    printf("\033[24H\r");
-    if ( msg ) printf("%s\n", msg);
-    printf("Total rows: %d\n",Grows);
-    fflush(stdout);
+    Screen *s = &Gscreen;
+
+    RenderStop();                       /* (the screen's ours again) */
+    ScreenPuts(s, "\033[24H\r");
+    if ( msg ) ScreenPrintf(s, "%s\n", msg);
+    ScreenPrintf(s, "Total rows: %d\n",Ggame.rows);
+    ScreenPrintf(s, "Seed: %llu\n", Ggame.seed);  /* (--seed replays the same shapes) */
+    if ( Grec.fp && ReplayClose(&Grec) < 0 )
+        ScreenPrintf(s, "%s: can't write replay\n", Grecord);
+    if ( Gtest && s->frames )
+        ScreenPrintf(s, "Frames: %ld, %ld bytes/frame, %ld.%02ld writes/frame\n",
+                     s->frames, s->totalbytes/s->frames,
+                     s->totalwrites/s->frames, (s->totalwrites*100/s->frames)%100);
+    if ( Gstats ) StatsDump();
+    ScreenFlush(s);
     EndTerminal();
     exit(v);
 }
 
 /* HANDLE READING BUTTON EVENTS AND UPDATING POSITION VARIS */
-int HandleButtons(int *x, int *y, int *rotate, int *yforce)
+int HandleButtons(TetrisInput *in)
 {
     int c, events=0;
     /* READ ALL BUFFERED KEYSTROKES */
     while ((c=ReadKey())) {
+        if (Gstats && !Gkeyns && c >= DOWN && c <= ROTATE)
+            Gkeyns = HistNow();                     /* (a move: time it 'til it's drawn) */
         switch(c) {
-            case   LEFT: *x      -= 1; ++events; break;
-            case  RIGHT: *x      += 1; ++events; break;
-            case   DOWN: *y      += 1; ++events; break;
-            case ROTATE: *rotate += 1; ++events; break;
+            case   LEFT: in->x      -= 1; ++events; break;
+            case  RIGHT: in->x      += 1; ++events; break;
+            case   DOWN: in->y      += 1; ++events; break;
+            case ROTATE: in->rotate += 1; ++events; break;
             case   QUIT: Texit("Quit", 1);       break;
-            case  PAUSE: while (!ReadKey()) { }  break;
+            case  PAUSE: do { WaitEvent(0, -1); CheckSIGINT(); }   /* block 'til a key */
+                         while (!ReadKey());
+                         StartTimer(Ggravity);   /* (a whole period 'til gravity) */
+                         Glastgravity = 0;       break;
             case   TEST: Gtest ^= 1;             break;  /* testing mode */
-            case REDRAW: Redraw(ALL);            break;
+            case REDRAW: if (Gflash) StartTimer(Ggravity);
+                         Gflash = 0;             /* (cuts any flash short) */
+                         Redraw(ALL);            break;
         }
     }
     return(events);
 }
 
-#define SIDES(x,y) ((x)<0||(x)>=GAMEWIDTH)
-#define BOTT(x,y) ((y)>=GAMEHEIGHT)
-#define TOP(x,y)  ((y)<0)
-#define CLIP(x,y) (TOP(x,y)||BOTT(x,y)||SIDES(x,y))
-
-/* CHECK IF SHAPE OVERLAPS OTHERS
- * Returns
- *      1 - hit left or right edges
- *      2 - hit bottom or petrified boxes
+/* ROW FLASH ANIMATION
+ *     Rows the engine deleted are flashed off, then on, before the screen
+ *     catches up with the engine. It's a timed state (Gflash) the main
+ *     loop advances, so keys are still read (and queued) while it runs.
  */
-int CollisionCheck(int x, int y, int rotate)
+#define FLASHSTEPS  2           /* off-on */
+#define FLASHMSEC   300         /* approx 1/3 sec per step */
+
+/* ADVANCE THE ROW FLASH ANIMATION */
+void FlashCompletedRows(void)
 {
-    int t, r;
-    int err=0;
-
-    for (t=0; t<SHAPEMAX; t++) {
-        for (r=0; r<SHAPEMAX; r++) {
-            if (Gshapes[Gshape][t][rotate][r]=='#') {
-                if (BOTT(x+r,y+t)) {
-                    return(2);         /* hit bottom */
-                }
-                if (SIDES(x+r,y+t)) {  /* hit edge, but continue looking for */
-                    err = 1;           /* petrified shape or bottom */
-                } else {
-                    if (Gscreen[y+t][x+r]==PETRIFIEDSHAPE) {
-                        return(2);     /* hit petrified shape */
-                    }
-                }
-            }
-        }
+    Frame f;
+
+    if (Gflash > FLASHSTEPS) {  /* done: show the engine's screen */
+        Gflash = 0;
+        StartTimer(Ggravity);
+        Redraw(CHANGED);
+        return;
     }
-    return(err);
+    FrameFlash(&f, &Ggame, !(Gflash&1));
+    SendFrame(&f);
+    Gflash++;
+    Gflashdue = NowMsec() + Gflashmsec;
 }
 
-/* DRAWS THE SHAPE INTO THE SCREEN ARRAY
- * Returns
- *      1 - hit left or right edges
- *      2 - hit bottom or petrified boxes
+/* HANDLE SHAPE DRAWING/COLLISIONS/CLIPPING
+ *     Runs the button events through the game engine, which marks
+ *     the rows that need redrawing.
  */
-int DrawShape(int x, int y, int rotate)
+void HandleShape(TetrisInput *in)
 {
-    int t, r;
-
-    /* DRAW THE SHAPE INTO THE SCREEN ARRAY */
-    for (t=0; t<SHAPEMAX; t++) {
-        for (r=0; r<SHAPEMAX; r++) {
-            if (CLIP(x+r, y+t)) {
-                continue;
-            } else {
-                Gscreen[y+t][x+r] |=
-                    (Gshapes[Gshape][t][rotate][r]=='#') ? NEWSHAPE : NOSHAPE;
-            }
-        }
+    TetrisInput asked = *in;            /* (TetrisStep() undoes moves in 'in') */
+    long long start = Gstats ? HistNow() : 0, end;
+    int ret = TetrisStep(&Ggame, in);
+
+    if (Gstats) {
+        end = HistNow();
+        if (!(ret & TETRIS_LOCKED))  HistAdd(&Gstat[STATCOLLIDE], end - start);
+        else if (ret & TETRIS_ROWS)  HistAdd(&Gstat[STATROWS],    end - start);
     }
-    return(0);
-}
 
- /* PETRIFY ALL SHAPES ON THE SCREEN */
-void PetrifyScreen(void)
-{
-    int x, y;
-
-    /* THIS PETRIFIES ANY OLD/OVERLAP DATA INTO PLACE
-     * (ie. the last drawn shape)
-     */
-    for (y=0; y<GAMEHEIGHT; y++)
-        for (x=0; x<GAMEWIDTH; x++)
-            Gscreen[y][x] = (Gscreen[y][x]) ? PETRIFIEDSHAPE : NOSHAPE;
-    MakeNewShape(1);
-}
+    if (Grec.fp) ReplayStep(&Grec, NowMsec() - Gstartms, &asked, &Ggame);
 
-/* FLASH THE ROWS */
-void FlashCompletedRows(int *rows, int trows)
-{
-    int x,t,r;
-    for (t=1; t<3; t++) {   /* off-on-off */
-        for (r=0; r<trows; r++)
-            for (x=0; x<GAMEWIDTH; x++)
-                Gscreen[rows[r]][x] = (t&1) ? OLDSHAPE : NEWSHAPE;
-        Redraw(CHANGED);
-        USLEEP(300000);     /* approx 1/3 sec delay */
+    if (ret & TETRIS_DIED) Texit("YOU DIED.", 1);
+    if (ret & TETRIS_ROWS) {                /* briefly flash completed rows on+off */
+        Gflash = 1;
+        Glastgravity = 0;                   /* (gravity's off 'til it's done) */
+        FlashCompletedRows();
     }
+    if (Gstats) HistAdd(&Gstat[STATSHAPE], HistNow() - start);
 }
 
-/* DELETE THE COMPLETED ROWS */
-void DeleteCompletedRows(int *rows, int trows)
+/* AUTOPLAY: SEND THE BOT'S NEXT KEY
+ *     The bot picks a placement for each new shape, then sends one key
+ *     per call towards it through HandleShape(), just as a player would.
+ *     If gravity carried the shape past its route, it picks again.
+ *     Once there, it forces the shape down instead of waiting on gravity.
+ */
+#define BOTMSEC     50          /* msecs between bot keys (at most) */
+
+void BotMove(void)
 {
-    int x,y,t;
-    for (t=0; t<trows; t++)
-        for(y=rows[t]; y>0; y--)
-            for (x=0; x<GAMEWIDTH; x++)
-                Gscreen[y][x] = Gscreen[y-1][x];    /* line above */
+    TetrisInput in;
+    int moves = -1;
+
+    if (Gbotpiece == Ggame.pieces)
+        moves = TetrisRoute(&Ggame, &Gbottarget, &in);
+    if (moves < 0) {
+        if (!BotChoose(&Ggame, &BotDefaultWeights, &Gbottarget))
+            return;                     /* nowhere to go: gravity ends it */
+        Gbotpiece = Ggame.pieces;
+        if ((moves = TetrisRoute(&Ggame, &Gbottarget, &in)) < 0) return;
+    }
+    if (moves == 0) in.yforce = 1;      /* there: drop it in place */
+    HandleShape(&in);
+    if (!Gflash) Redraw(CHANGED);
 }
 
-/* FIND COMPLETED ROWS, AND DELETE ACCORDINGLY */
-void HandleCompletedRows(void)
+/* REPLAY KEYS: ONLY QUIT, PAUSE AND REDRAW DO ANYTHING
+ *     Returns msecs spent paused.
+ */
+long ReplayButtons(void)
 {
-    int x,y,total,trows=0, rows[GAMEHEIGHT];
-
-    /* Find total completed rows (trows) */
-    for (y=0; y<GAMEHEIGHT; y++) {
-        for (x=0,total=GAMEWIDTH; x<GAMEWIDTH; x++) {
-            if (Gscreen[y][x]==NOSHAPE) break;
-            else                        --total;
+    long paused = 0, t;
+    int c;
+    while ((c=ReadKey())) {
+        switch(c) {
+            case   QUIT: Texit("Quit", 1);       break;
+            case  PAUSE: t = NowMsec();
+                         do { WaitEvent(0, -1); CheckSIGINT(); }   /* block 'til a key */
+                         while (!ReadKey());
+                         paused += NowMsec() - t; break;
+            case REDRAW: Redraw(ALL);            break;
         }
-        if (total==0) { rows[trows++] = y; }
-    }
-
-    /* Found completed rows? Handle.. */
-    if (trows) {
-        FlashCompletedRows(rows, trows);    /* briefly flashes completed rows on+off */
-        DeleteCompletedRows(rows, trows);   /* removes completed rows */
-        Redraw(GSCREEN);
-        Grows += trows;
     }
-
-    /* CLEAR THE KEYBOARD BUFFER */
-    while (ReadKey()) { }
+    return(paused);
 }
 
-/* HANDLE SHAPE DRAWING/COLLISIONS/CLIPPING */
-void HandleShape(int *x, int *y, int *rotate, int *yforce)
+/* PLAY BACK A --replay FILE
+ *     Starts at --seek msecs into the game: the engine state comes
+ *     from the keyframe before it, plus the few steps since. Steps
+ *     are then run through HandleShape() as they were played, --speed
+ *     times faster.
+ */
+void PlayReplay(void)
 {
-    /* CHECK IF SHAPE TOUCHES OTHERS OR SCREEN BOTTOM IN REQUESTED ORIENTATION
-     */
-    while (1) {
-        switch(CollisionCheck(Gx + *x,
-                              Gy + *y + *yforce,
-                              (Grotate + *rotate) % 4)) {
-            case 1: /* LEFT/RIGHT EDGE COLLISION */
-                /* Undo button events until no collision */
-                if (*rotate!=0) { *rotate -= ZSGN(*rotate); continue; }
-                if (*x!=0)      { *x -= ZSGN(*x); continue; }
-                if (*y!=0)      { *y -= ZSGN(*y); continue; }
-                break;
-
-            case 2: /* BOTTOM OR PETRIFIED COLLISION */
-                /* Undo button events to avoid collision */
-                if (ABS(*rotate)!=0) { *rotate -= ZSGN(*rotate); continue; }
-                if (ABS(*x)!=0)      { *x      -= ZSGN(*x);      continue; }
-                if (ABS(*y)!=0)      { *y      -= ZSGN(*y);      continue; }
-
-                if (Gy<1) Texit("YOU DIED.", 1);
-
-                /* Draw shape in old position and petrify accordingly */
-                DrawShape(Gx, Gy, (Grotate % 4));
-                PetrifyScreen();
-                HandleCompletedRows();
-                break;
+    TetrisInput in;
+    long ms, due, wait, start, paused;
+    int i;
+
+    if (Gseek > 0) ReplaySeek(&Gplay, &Ggame, Gseek);
+    else           ReplayStart(&Gplay, &Ggame);
+    Redraw(ALL);
+
+    start = NowMsec() - (long)(Gplay.ms / Gspeed);  /* when replay time 0 was */
+    while (ReplayNext(&Gplay, &in, &ms)) {
+        due = start + (long)(ms / Gspeed);
+        while (Gflash || NowMsec() < due) {
+            wait = (Gflash ? Gflashdue : due) - NowMsec();
+            i = WaitEvent(0, FrameWait(wait < 0 ? 0 : wait));
+            CheckSIGINT();
+            if (i & KEYEVENT) {
+                paused     = ReplayButtons();
+                start     += paused;            /* carry on where we were */
+                due       += paused;
+                Gflashdue += paused;
+            }
+            if (Gflash && NowMsec() >= Gflashdue) FlashCompletedRows();
+            if (Gdumpstats) StatsDump();
         }
-        break;
+        HandleShape(&in);
+        if (!Gflash) Redraw(CHANGED);
     }
-
-    /* APPLY THE REVISED MOVEMENTS TO THE MOVING SHAPE */
-    Gx      += *x;
-    Gy      += (*y + *yforce);
-    Grotate += *rotate;
-    DrawShape(Gx, Gy, (Grotate % 4));
+    Texit("End of replay.", 0);
 }
 
-int main()
+int main(int argc, char **argv)
 {
     char s[5];
-    int x,y,rotate,yforce;
+    int i;
+    long wait;
+    TetrisInput in;
+
+    for (i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--gravity")==0 && i+1<argc && atol(argv[i+1]) > 0) {
+            Ggravity = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--seed")==0 && i+1<argc) {
+            Gseed   = strtoull(argv[++i], NULL, 10);
+            Gseeded = 1;
+        } else if (strcmp(argv[i], "--bot")==0) {
+            Gbot = 1;
+        } else if (strcmp(argv[i], "--record")==0 && i+1<argc) {
+            Grecord = argv[++i];
+        } else if (strcmp(argv[i], "--replay")==0 && i+1<argc) {
+            Greplay = argv[++i];
+        } else if (strcmp(argv[i], "--seek")==0 && i+1<argc) {
+            Gseek = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--speed")==0 && i+1<argc && atof(argv[i+1]) > 0) {
+            Gspeed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--stats")==0 && i+1<argc) {
+            Gstats = argv[++i];
+        } else {
+            fprintf(stderr, "usage: tetris [--gravity msec] [--seed n] [--bot] [--record file] [--stats file]\n"
+                            "       tetris --replay file [--seek msec] [--speed n] [--stats file]\n");
+            exit(1);
+        }
+    }
+    Gflashmsec = (long)(FLASHMSEC / Gspeed);
+    if (Gstats) StatsStart();
+
+    if (Greplay) {
+        unsigned char *data;
+        long size;
+        if (ReplayLoad(Greplay, &data, &size) < 0) { perror(Greplay); exit(1); }
+        if (ReplayOpen(&Gplay, data, size) < 0) {
+            fprintf(stderr, "%s: not a replay file\n", Greplay);
+            exit(1);
+        }
+        InitTerminal();
+        Gterm = getenv("TERM");
+        ScreenInit(&Gscreen, Gterm, Gframe, FRAMEMAX, WriteFrame, NULL);
+        RenderStart();
+        PlayReplay();
+    }
 
     fprintf(stderr,
         "\nTetris for terminals - V %s - 1992,2017 Greg Ercolano\n"
@@ -571,15 +705,51 @@ int main()
 
     InitTerminal();                     /* init termios */
     Gterm = getenv("TERM");
+    ScreenInit(&Gscreen, Gterm, Gframe, FRAMEMAX, WriteFrame, NULL);
+    RenderStart();
+
+    if (Gbot) {
+        BotStart(0);                    /* one thread per CPU */
+        Gbotmsec = (Ggravity/8 < BOTMSEC) ? Ggravity/8 : BOTMSEC;   /* keep up */
+        if (Gbotmsec < 1) Gbotmsec = 1;                             /* (fast gravity) */
+    }
 
     Clear();
+    Gstartms = NowMsec();
+    if (Grecord && ReplayCreate(&Grec, Grecord, &Ggame) < 0) {
+        EndTerminal();
+        perror(Grecord);
+        exit(1);
+    }
+    StartTimer(Ggravity);
     while (1) {
-        x = y = rotate = yforce = 0;
-        HandleTimer(&yforce);           /* forces piece downward by clock time */
-        HandleButtons(&x, &y, &rotate, &yforce);
-        if ( x || y || rotate || yforce) {
-            HandleShape(&x, &y, &rotate, &yforce);
-            Redraw(CHANGED);            /* redraw only if something changed */
+        /* SLEEP 'TIL A KEY, GRAVITY, THE NEXT FLASH STEP OR BOT KEY */
+        wait = -1;
+        if (Gflash)     wait = Gflashdue - NowMsec();
+        else if (Gbot)  wait = Gbotdue - NowMsec();
+        if ((Gflash || Gbot) && wait < 0) wait = 0;
+        i = WaitEvent(!Gflash, FrameWait(wait));
+        CheckSIGINT();
+        if (i & TIMEREVENT) {
+            Gqueue.yforce = 1;          /* forces piece downward by clock time */
+            if (Gstats) StatsGravity();
+        }
+        if (Gdumpstats) StatsDump();
+        if (i & KEYEVENT)
+            HandleButtons(&Gqueue);
+        if (Gflash) {                   /* keys wait in Gqueue 'til it's done */
+            if (NowMsec() >= Gflashdue) FlashCompletedRows();
+            if (Gflash) continue;
+        }
+        if ( Gqueue.x || Gqueue.y || Gqueue.rotate || Gqueue.yforce) {
+            in = Gqueue;
+            Gqueue.x = Gqueue.y = Gqueue.rotate = Gqueue.yforce = 0;
+            HandleShape(&in);
+            if (!Gflash) Redraw(CHANGED);   /* redraw only if something changed */
+        }
+        if (Gbot && !Gflash && NowMsec() >= Gbotdue) {
+            BotMove();
+            Gbotdue = NowMsec() + Gbotmsec;
         }
     }
     Texit("WHILE LOOP", 1);